@@ -0,0 +1,374 @@
+// ==========================================================================
+// Batch processing of image files without the interactive viewer
+// ==========================================================================
+
+#include "batch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "decodepool.h"
+#include "tilerender.h"
+#include "trace.h"
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// Filter chain parsing
+
+namespace
+{
+	struct ChainName
+	{
+		const char *name;
+		FilterStage::Kind kind;
+		int type;
+	};
+
+	const ChainName chainNames[] = {
+		{ "blur3", FilterStage::BLUR, 1 },
+		{ "blur5", FilterStage::BLUR, 2 },
+		{ "blur7", FilterStage::BLUR, 3 },
+		{ "sobelx", FilterStage::KERNEL, 1 },
+		{ "sobelv", FilterStage::KERNEL, 1 },
+		{ "sobely", FilterStage::KERNEL, 2 },
+		{ "sobelh", FilterStage::KERNEL, 2 },
+		{ "unsharp", FilterStage::KERNEL, 3 },
+		{ "grey", FilterStage::COLOUR, 1 },
+		{ "grey601", FilterStage::COLOUR, 2 },
+		{ "grey709", FilterStage::COLOUR, 3 },
+		{ "sepia", FilterStage::COLOUR, 4 },
+		{ "grunge", FilterStage::COLOUR, 5 },
+		{ "threshold", FilterStage::COLOUR, 5 },
+		{ "negative", FilterStage::COLOUR, 6 },
+	};
+}
+
+bool ParseFilterChain(const string &chain, vector<FilterStage> *stages, string *error)
+{
+	stages->clear();
+	stringstream input(chain);
+	string name;
+	while (getline(input, name, ',')) {
+		if (name.empty()) continue;
+
+		// gaussN gives a Gaussian blur of sigma N texels, e.g. gauss4.5
+		if (name.compare(0, 5, "gauss") == 0) {
+			char *end = nullptr;
+			float sigma = strtof(name.c_str() + 5, &end);
+			if (end != name.c_str() + 5 && *end == '\0' && sigma > 0.f) {
+				stages->push_back(FilterStage(FilterStage::BLUR, GAUSSIAN_BLUR, sigma));
+				continue;
+			}
+		}
+
+		bool found = false;
+		for (const ChainName &entry : chainNames) {
+			if (name == entry.name) {
+				stages->push_back(FilterStage(entry.kind, entry.type));
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			*error = name;
+			return false;
+		}
+	}
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Per-image processing
+
+namespace
+{
+	double Seconds(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// output path of each input: its file name with the extension of the
+	// format in dir. Inputs that would share a name, such as a.jpg and a.png
+	// or x/a.jpg and y/a.jpg, get a number after it, e.g. a-2.png, and the
+	// renaming is printed
+	unordered_map<string, string> OutputPaths(const vector<string> &inputs, const string &dir,
+		ImageFormat format)
+	{
+		unordered_map<string, string> paths;
+		unordered_set<string> used;
+		string extension = string(".") + FormatExtension(format);
+		for (const string &input : inputs) {
+			size_t slash = input.find_last_of('/');
+			string name = slash == string::npos ? input : input.substr(slash + 1);
+			size_t dot = name.find_last_of('.');
+			if (dot != string::npos) name.erase(dot);
+
+			string path = dir + "/" + name + extension;
+			if (used.count(path)) {
+				for (int copy = 2; used.count(path); copy++)
+					path = dir + "/" + name + "-" + to_string(copy) + extension;
+				cout << "Another input is also named " << name << ", writing " << input << " to "
+					<< path << endl;
+			}
+			used.insert(path);
+			paths[input] = path;
+		}
+		return paths;
+	}
+
+	// replaces the contents of the texture, keeping its storage when the
+	// size and format are unchanged
+	bool UploadImage(MyTexture *texture, const DecodedImage &image)
+	{
+		GLuint format = TextureFormat(image.components);
+		if (texture->textureID != 0 && texture->width == image.width
+			&& texture->height == image.height && texture->format == format) {
+			glBindTexture(texture->target, texture->textureID);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(texture->target, 0, 0, 0, image.width, image.height, format,
+				GL_UNSIGNED_BYTE, image.pixels);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindTexture(texture->target, 0);
+			return !CheckGLErrors();
+		}
+		DestroyTexture(texture);
+		*texture = MyTexture();
+		return InitializeTexture(texture, image, GL_TEXTURE_RECTANGLE);
+	}
+
+	// how much of the time spent filtering each CPU thread was working
+	void PrintWorkerStats(const WorkPool &pool)
+	{
+		vector<WorkerStats> workers = pool.Stats();
+		double wall = pool.RunSeconds();
+		double busy = 0.0;
+		for (size_t i = 0; i < workers.size(); i++) {
+			const WorkerStats &stats = workers[i];
+			busy += stats.busySeconds;
+			cout << "CPU thread " << i << ": " << stats.tasks << " tasks (" << stats.steals
+				<< " stolen), busy " << stats.busySeconds * 1000.0 << " ms, "
+				<< (wall > 0.0 ? 100.0 * stats.busySeconds / wall : 0.0) << "% utilized" << endl;
+		}
+		cout << "CPU threads were " << (wall > 0.0 ? 100.0 * busy / (wall * workers.size()) : 0.0)
+			<< "% utilized over " << wall * 1000.0 << " ms of parallel work" << endl;
+	}
+}
+
+int RunBatch(const BatchOptions &options, FilterGraph *graph)
+{
+	vector<FilterStage> stages;
+	unique_ptr<WorkPool> cpuPool;
+	string badName;
+	if (!ParseFilterChain(options.chain, &stages, &badName)) {
+		cout << "Unknown filter \"" << badName << "\" in chain " << options.chain << endl;
+		return int(options.inputs.size());
+	}
+	// the CPU threads also encode the output files, so they exist for both
+	// backends
+	cpuPool.reset(new WorkPool(options.cpuThreads));
+	WriteOptions writeOptions = options.write;
+	writeOptions.pool = cpuPool.get();
+	if (graph) {
+		graph->Clear();
+		for (const FilterStage &stage : stages)
+			graph->AddStage(stage);
+	}
+	else {
+		cout << "Filtering on the CPU with " << IsaName(ActiveIsa()) << " kernels on "
+			<< cpuPool->Threads() << " threads" << endl;
+	}
+
+	// the decode pool merges requests for the same path, so each file is
+	// processed once however often it was given
+	vector<string> inputs;
+	for (const string &input : options.inputs) {
+		if (find(inputs.begin(), inputs.end(), input) == inputs.end())
+			inputs.push_back(input);
+	}
+
+	if (mkdir(options.outputDir.c_str(), 0755) != 0 && errno != EEXIST) {
+		cout << "Unable to create output directory " << options.outputDir << endl;
+		return int(options.inputs.size());
+	}
+	unordered_map<string, string> outputPaths = OutputPaths(inputs, options.outputDir, writeOptions.format);
+
+	// decodes finish out of order; the pool counts each one it finishes and
+	// wakes this thread, which waits until the count is non-zero, so a
+	// decode finishing while the previous ones are processed is not missed
+	DecodePool pool(options.decodeThreads);
+	pool.SetReadAhead(options.readAhead);
+	mutex readyMutex;
+	condition_variable readyWake;
+	size_t readyCount = 0;
+	pool.SetReadyCallback([&] {
+		lock_guard<mutex> lock(readyMutex);
+		readyCount++;
+		readyWake.notify_one();
+	});
+
+	// keep a bounded number of decoded images in flight so thousands of
+	// inputs do not all sit in memory at once
+	size_t lookahead = max<size_t>(4, 2 * thread::hardware_concurrency());
+	size_t requested = 0;
+	size_t done = 0;
+	size_t mappedAhead = 0;
+	int failures = 0;
+	double totalPixels = 0.0;
+	double renderSeconds = 0.0;
+	double encodeSeconds = 0.0;
+	size_t encodedBytes = 0;
+	size_t fileBytes = 0;
+	MyTexture source;
+	TileRenderer tiles;
+	bool tilesReady = false;
+	int maxTexture = graph ? MaxTextureSize() : 0;
+	CpuImage cpuSource;
+	CpuImage cpuOutput;
+	vector<unsigned char> pixels;
+
+	auto start = chrono::steady_clock::now();
+	while (done < inputs.size()) {
+		while (requested < inputs.size() && requested - done < lookahead)
+			pool.Request(inputs[requested++]);
+
+		DecodeResult result;
+		{
+			unique_lock<mutex> lock(readyMutex);
+			readyWake.wait(lock, [&] { return readyCount > 0; });
+			readyCount = 0;
+		}
+		while (pool.Poll(&result)) {
+			TRACE_SCOPE("RunBatch image");
+			done++;
+			if (result.mappedAhead) mappedAhead++;
+			if (!result.image) {
+				cout << "Unable to decode " << result.path << endl;
+				failures++;
+				continue;
+			}
+			const DecodedImage &image = *result.image;
+
+			int row = image.width * 3;
+			pixels.resize(size_t(row) * image.height);
+			double render = 0.0;
+			double readback = 0.0;
+			size_t rowBytes = 0;
+			if (graph && (image.width > maxTexture || image.height > maxTexture)) {
+				// too large for one texture: the tiles are read back as they
+				// are filtered, so the readback is part of the render time
+				auto renderStart = chrono::steady_clock::now();
+				if (!tilesReady) tilesReady = tiles.Initialize();
+				if (!tilesReady || !tiles.Begin(result.image, stages)) {
+					cout << "Unable to filter " << result.path << " in tiles" << endl;
+					failures++;
+					continue;
+				}
+				while (!tiles.Step(true));
+				if (tiles.Failed()) {
+					cout << "Unable to filter " << result.path << " in tiles" << endl;
+					failures++;
+					continue;
+				}
+				pixels.swap(tiles.Pixels());
+				render = Seconds(renderStart);
+				const TileStats &stats = tiles.Stats();
+				cout << result.path << ": " << stats.tiles << " tiles of " << stats.tileSize
+					<< " pixels with a " << stats.border << " pixel border, "
+					<< stats.waitSeconds * 1000.0 << " ms waiting for readbacks" << endl;
+			}
+			else if (graph) {
+				// upload, filter and wait for the GPU, so render time is real
+				auto renderStart = chrono::steady_clock::now();
+				if (!UploadImage(&source, image)) {
+					cout << "Unable to upload " << result.path << endl;
+					failures++;
+					continue;
+				}
+				graph->Invalidate();
+				const MyTexture &output = graph->Run(source);
+				glFinish();
+				render = Seconds(renderStart);
+
+				// read back as RGB; the image rows are bottom-up, so the PNG
+				// is written from the last row with a negative stride
+				auto readStart = chrono::steady_clock::now();
+				glPixelStorei(GL_PACK_ALIGNMENT, 1);
+				glBindTexture(output.target, output.textureID);
+				glGetTexImage(output.target, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+				glBindTexture(output.target, 0);
+				glPixelStorei(GL_PACK_ALIGNMENT, 4);
+				readback = Seconds(readStart);
+			}
+			else {
+				// the conversions to and from planes stand in for the upload
+				// and readback; streamed rows are converted as they go
+				auto renderStart = chrono::steady_clock::now();
+				if (options.tileSize > 0) {
+					ImageFromBytes(image.pixels, image.width, image.height, image.components, &cpuSource,
+						cpuPool.get());
+					RunCpuStages(stages, cpuSource, &cpuOutput, cpuPool.get(), options.tileSize);
+					render = Seconds(renderStart);
+
+					auto readStart = chrono::steady_clock::now();
+					ImageToBytes(cpuOutput, 3, pixels.data(), cpuPool.get());
+					readback = Seconds(readStart);
+				}
+				else {
+					rowBytes = StreamCpuStages(stages, image.pixels, image.width, image.height,
+						image.components, pixels.data(), 3, cpuPool.get());
+					render = Seconds(renderStart);
+				}
+			}
+
+			const string &path = outputPaths[result.path];
+			WriteStats file;
+			if (!SaveImage(path.c_str(), image.width, image.height,
+				pixels.data() + size_t(row) * (image.height - 1), 3, -row, writeOptions, &file)) {
+				failures++;
+				continue;
+			}
+			encodeSeconds += file.encodeSeconds;
+			encodedBytes += file.imageBytes;
+			fileBytes += file.fileBytes;
+
+			double megapixels = double(image.width) * image.height / 1e6;
+			totalPixels += megapixels;
+			renderSeconds += render;
+			cout << result.path << " (" << image.width << "x" << image.height << "): decode "
+				<< result.seconds * 1000.0 << " ms, render " << render * 1000.0 << " ms ("
+				<< (render > 0.0 ? megapixels / render : 0.0) << " MP/s), readback "
+				<< readback * 1000.0 << " ms, encode " << file.encodeSeconds * 1000.0 << " ms ("
+				<< (file.encodeSeconds > 0.0 ? file.imageBytes / file.encodeSeconds / 1e6 : 0.0) << " MB/s in "
+				<< file.bands << " bands), write " << file.writeSeconds * 1000.0 << " ms -> " << path;
+			if (rowBytes > 0) cout << " (" << (rowBytes >> 10) << " KB of row buffers)";
+			cout << endl;
+		}
+	}
+	double elapsed = Seconds(start);
+	if (graph) DestroyTexture(&source);
+	if (tilesReady) tiles.Destroy();
+
+	cout << "Processed " << (done - failures) << " of " << inputs.size() << " images, "
+		<< totalPixels << " MP in " << elapsed << " s: " << (elapsed > 0.0 ? totalPixels / elapsed : 0.0)
+		<< " MP/s overall, " << (renderSeconds > 0.0 ? totalPixels / renderSeconds : 0.0)
+		<< " MP/s filtering" << endl;
+	if (options.readAhead > 0)
+		cout << mappedAhead << " of " << done << " inputs were mapped ahead of decoding" << endl;
+	cout << "Encoded " << encodedBytes / 1e6 << " MB of pixels as " << FormatExtension(writeOptions.format)
+		<< " at " << (encodeSeconds > 0.0 ? encodedBytes / encodeSeconds / 1e6 : 0.0) << " MB/s into "
+		<< fileBytes / 1e6 << " MB of files" << endl;
+	PrintWorkerStats(*cpuPool);
+	return failures;
+}
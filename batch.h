@@ -0,0 +1,52 @@
+// ==========================================================================
+// Batch processing of image files without the interactive viewer
+//
+// Each input file is decoded on the decode pool, run through a filter chain
+// given as text, read back and written as a PNG, or in another format of
+// the write options, into an output directory.
+// Decoding runs ahead of rendering on the worker threads, so the render
+// thread only uploads, filters and writes. Timings and throughput in
+// megapixels per second are printed for every image and for the whole run.
+// The chain runs either on the GPU through the filter graph or on the CPU
+// filter engine, which needs no OpenGL context at all. The CPU engine
+// streams bands of rows through the chain on all cores, keeping only a few
+// rows of each intermediate image, or splits each image into tiles.
+// ==========================================================================
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "cpufilters.h"
+#include "filtergraph.h"
+#include "imagewrite.h"
+
+struct BatchOptions
+{
+	std::vector<std::string> inputs;
+	std::string chain;			// comma separated stage names
+	std::string outputDir;
+	unsigned decodeThreads;		// zero picks one less than the core count
+	int readAhead;				// inputs mapped ahead of the decoders
+	unsigned cpuThreads;		// threads of the CPU engine, zero for all cores
+	int tileSize;				// tile edge in texels for the CPU engine, zero
+								// to stream rows instead
+	WriteOptions write;			// output format; bands are encoded on the
+								// CPU engine's threads
+
+	BatchOptions() : outputDir("."), decodeThreads(0), readAhead(0), cpuThreads(0), tileSize(0)
+	{}
+};
+
+// parses a chain such as "blur7,sobelx,grey709" into stages, returning false
+// and naming the offending entry in error if a name is not recognised
+bool ParseFilterChain(const std::string &chain, std::vector<FilterStage> *stages,
+	std::string *error);
+
+// processes every input through the graph, which must be initialized in a
+// current OpenGL context, or through the CPU engine if graph is null;
+// returns the number of inputs that failed
+int RunBatch(const BatchOptions &options, FilterGraph *graph);
+
+#endif
@@ -0,0 +1,418 @@
+// ==========================================================================
+// Benchmark of every effect on both backends
+// ==========================================================================
+
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include "cpufilters.h"
+#include "imagecache.h"
+#include "tilerender.h"
+#include "workpool.h"
+
+using namespace std;
+
+namespace
+{
+	// images with an edge above this are filtered on the GPU in tiles, as
+	// exports of huge images are, rather than through image-sized half float
+	// targets, of which a 16k image would need several gigabytes
+	const int SINGLE_PASS_LIMIT = 4096;
+
+	// an effect and the key that selects it in the viewer
+	struct BenchMode
+	{
+		const char *key;
+		FilterStage stage;
+	};
+
+	struct BenchResult
+	{
+		string backend;
+		string image;
+		string filter;
+		string key;
+		int width;
+		int height;
+		bool tiled;
+		vector<double> ms;		// one per trial, sorted
+	};
+
+	vector<BenchMode> Modes(float sigma)
+	{
+		static const char *colourKeys[] = { "W", "E", "R", "T", "Y", "U" };
+		static const char *kernelKeys[] = { "Z", "X", "C" };
+		static const char *blurKeys[] = { "V", "B", "N" };
+
+		vector<BenchMode> modes;
+		for (int type = 1; type <= 6; type++)
+			modes.push_back({ colourKeys[type - 1], FilterStage(FilterStage::COLOUR, type) });
+		for (int type = 1; type <= 3; type++)
+			modes.push_back({ kernelKeys[type - 1], FilterStage(FilterStage::KERNEL, type) });
+		for (int type = 1; type <= 3; type++)
+			modes.push_back({ blurKeys[type - 1], FilterStage(FilterStage::BLUR, type) });
+		modes.push_back({ "M", FilterStage(FilterStage::BLUR, GAUSSIAN_BLUR, sigma) });
+
+		// the offsets do not change the work done, so they are left at zero,
+		// which is also what the GPU reads from the default view state
+		modes.push_back({ "F/G/H", FilterStage(FilterStage::HUE) });
+		return modes;
+	}
+
+	double Seconds(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// smooth gradients under a fine checker and hashed noise, so the edge
+	// filters and blurs have both flat areas and detail to work on
+	shared_ptr<DecodedImage> SyntheticImage(int size)
+	{
+		shared_ptr<DecodedImage> image(new DecodedImage());
+		// freed by stbi_image_free() like a decoded image
+		image->pixels = static_cast<unsigned char *>(malloc(size_t(size) * size * 3));
+		if (!image->pixels) return nullptr;
+		image->width = size;
+		image->height = size;
+		image->components = 3;
+		for (int y = 0; y < size; y++) {
+			unsigned char *row = image->pixels + size_t(y) * size * 3;
+			for (int x = 0; x < size; x++) {
+				unsigned hash = unsigned(x) * 374761393u + unsigned(y) * 668265263u;
+				hash = (hash ^ (hash >> 13)) * 1274126177u;
+				int noise = int(hash >> 28) - 8;
+				int checker = ((x >> 3) ^ (y >> 3)) & 1 ? 24 : 0;
+				row[3 * x] = (unsigned char)min(max(int(255.0 * x / size) + noise, 0), 255);
+				row[3 * x + 1] = (unsigned char)min(max(int(255.0 * y / size) + checker, 0), 255);
+				row[3 * x + 2] = (unsigned char)min(max(128 + checker - noise, 0), 255);
+			}
+		}
+		return image;
+	}
+
+	// runs the case untimed for the warmup, then times trials until there
+	// are enough or the case has taken too long; false if a run failed
+	bool TimeCase(const BenchOptions &options, const function<bool()> &run, vector<double> *ms)
+	{
+		for (int i = 0; i < options.warmup; i++) {
+			if (!run()) return false;
+		}
+		int trials = max(options.trials, 1);
+		int minimum = min(trials, MIN_BENCH_TRIALS);
+		auto start = chrono::steady_clock::now();
+		while (int(ms->size()) < trials) {
+			auto trialStart = chrono::steady_clock::now();
+			if (!run()) return false;
+			ms->push_back(Seconds(trialStart) * 1000.0);
+			if (int(ms->size()) >= minimum && Seconds(start) > options.caseSeconds) break;
+		}
+		sort(ms->begin(), ms->end());
+		return true;
+	}
+
+	double Median(const vector<double> &sorted)
+	{
+		size_t middle = sorted.size() / 2;
+		return sorted.size() % 2 ? sorted[middle] : 0.5 * (sorted[middle - 1] + sorted[middle]);
+	}
+
+	// nearest rank, so with few trials it is the slowest one
+	double Percentile(const vector<double> &sorted, double fraction)
+	{
+		size_t rank = size_t(fraction * sorted.size() + 0.999999);
+		return sorted[min(max<size_t>(rank, 1), sorted.size()) - 1];
+	}
+
+	double Mean(const vector<double> &values)
+	{
+		double total = 0.0;
+		for (double value : values) total += value;
+		return total / values.size();
+	}
+
+	double Throughput(const BenchResult &result)
+	{
+		double median = Median(result.ms);
+		return median > 0.0 ? double(result.width) * result.height / 1e6 / (median * 1e-3) : 0.0;
+	}
+
+	string Quoted(const string &text)
+	{
+		string quoted = "\"";
+		for (char c : text) {
+			if (c == '"' || c == '\\') quoted += '\\';
+			quoted += c;
+		}
+		return quoted + "\"";
+	}
+
+	bool WriteResults(const BenchOptions &options, const string &renderer, unsigned threads,
+		const vector<BenchResult> &results)
+	{
+		ofstream out(options.output.c_str());
+		if (!out) return false;
+
+		char date[32];
+		time_t now = time(nullptr);
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+		out << "{\n\t\"date\": \"" << date << "\",\n"
+			<< "\t\"renderer\": " << Quoted(renderer) << ",\n"
+			<< "\t\"cpu_isa\": \"" << IsaName(ActiveIsa()) << "\",\n"
+			<< "\t\"cpu_threads\": " << threads << ",\n"
+			<< "\t\"warmup\": " << options.warmup << ",\n"
+			<< "\t\"trials\": " << options.trials << ",\n"
+			<< "\t\"results\": [";
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchResult &result = results[i];
+			out << (i ? ",\n\t\t" : "\n\t\t") << "{\"backend\": \"" << result.backend
+				<< "\", \"image\": " << Quoted(result.image) << ", \"width\": " << result.width
+				<< ", \"height\": " << result.height << ", \"filter\": " << Quoted(result.filter)
+				<< ", \"key\": \"" << result.key << "\", \"tiled\": " << (result.tiled ? "true" : "false")
+				<< ", \"trials\": " << result.ms.size() << ", \"median_ms\": " << Median(result.ms)
+				<< ", \"p95_ms\": " << Percentile(result.ms, 0.95) << ", \"min_ms\": " << result.ms.front()
+				<< ", \"mean_ms\": " << Mean(result.ms) << ", \"megapixels_per_second\": "
+				<< Throughput(result) << "}";
+		}
+		out << "\n\t]\n}\n";
+		return bool(out);
+	}
+
+	// filters the image with the stages on the GPU, in tiles if it is too
+	// large, and reads the result back as RGB rows in the image's order
+	bool GpuOutput(FilterGraph *graph, TileRenderer *tiles, bool *tilesReady,
+		const shared_ptr<DecodedImage> &image, const MyTexture &texture, bool tiled,
+		const vector<FilterStage> &stages, vector<unsigned char> *pixels)
+	{
+		if (tiled) {
+			if (!*tilesReady) *tilesReady = tiles->Initialize();
+			if (!*tilesReady || !tiles->Begin(image, stages)) return false;
+			while (!tiles->Step(true));
+			if (tiles->Failed()) return false;
+			pixels->swap(tiles->Pixels());
+			return true;
+		}
+
+		graph->Clear();
+		for (const FilterStage &stage : stages)
+			graph->AddStage(stage);
+		const MyTexture &output = graph->Run(texture);
+		if (output.textureID == texture.textureID) return false;
+		pixels->resize(size_t(image->width) * image->height * 3);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glBindTexture(output.target, output.textureID);
+		glGetTexImage(output.target, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels->data());
+		glBindTexture(output.target, 0);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		return !CheckGLErrors();
+	}
+}
+
+void DefaultBenchInputs(BenchOptions *options)
+{
+	options->images = { "test.jpg", "mandrill.png", "uclogo.png", "aerial.jpg" };
+	options->sizes = { 256, 1024, 4096, 16384 };
+}
+
+bool ParseBenchSizes(const string &list, vector<int> *sizes)
+{
+	vector<int> parsed;
+	stringstream input(list);
+	string entry;
+	while (getline(input, entry, ',')) {
+		if (entry.empty()) continue;
+		char *end = nullptr;
+		long size = strtol(entry.c_str(), &end, 10);
+		if (*end != '\0' || size <= 0 || size > 65536) return false;
+		parsed.push_back(int(size));
+	}
+	if (parsed.empty()) return false;
+	sizes->swap(parsed);
+	return true;
+}
+
+bool VerifyBackends(const BenchOptions &options, FilterGraph *graph)
+{
+	vector<BenchMode> modes = Modes(options.blurSigma);
+	unique_ptr<WorkPool> pool(new WorkPool(options.cpuThreads));
+	cout << "Comparing " << modes.size() << " effects on " << glGetString(GL_RENDERER) << " with "
+		<< IsaName(ActiveIsa()) << " CPU kernels, allowing a difference of " << VERIFY_TOLERANCE
+		<< " in " << 100.0 * VERIFY_OUTLIERS << "% of channels" << endl;
+
+	vector<string> names = options.images;
+	for (int size : options.sizes)
+		names.push_back("synthetic " + to_string(size));
+
+	TileRenderer tiles;
+	bool tilesReady = false;
+	int limit = min(MaxTextureSize(), SINGLE_PASS_LIMIT);
+	int cases = 0;
+	int failures = 0;
+	for (size_t input = 0; input < names.size(); input++) {
+		const string &name = names[input];
+		shared_ptr<DecodedImage> image = input < options.images.size()
+			? DecodeImage(name.c_str()) : SyntheticImage(options.sizes[input - options.images.size()]);
+		if (!image || !image->pixels) {
+			cout << "Unable to load " << name << endl;
+			failures++;
+			continue;
+		}
+		bool tiled = image->width > limit || image->height > limit;
+		MyTexture texture;
+		if (!tiled && !InitializeTexture(&texture, *image, GL_TEXTURE_RECTANGLE)) {
+			cout << "Unable to upload " << name << endl;
+			failures++;
+			continue;
+		}
+
+		vector<unsigned char> gpu;
+		vector<unsigned char> cpu(size_t(image->width) * image->height * 3);
+		for (const BenchMode &mode : modes) {
+			vector<FilterStage> stages(1, mode.stage);
+			cases++;
+			if (!GpuOutput(graph, &tiles, &tilesReady, image, texture, tiled, stages, &gpu)) {
+				cout << name << " " << StageName(mode.stage) << ": the GPU failed" << endl;
+				failures++;
+				continue;
+			}
+			StreamCpuStages(stages, image->pixels, image->width, image->height, image->components,
+				cpu.data(), 3, pool.get());
+
+			int largest = 0;
+			size_t outliers = 0;
+			for (size_t i = 0; i < cpu.size(); i++) {
+				int difference = abs(int(cpu[i]) - int(gpu[i]));
+				largest = max(largest, difference);
+				if (difference > VERIFY_TOLERANCE) outliers++;
+			}
+			double fraction = double(outliers) / cpu.size();
+			bool passed = fraction <= VERIFY_OUTLIERS;
+			if (!passed) failures++;
+			cout << (passed ? "ok   " : "FAIL ") << name << " (" << image->width << "x" << image->height
+				<< (tiled ? ", tiled" : "") << ") " << StageName(mode.stage) << ": largest difference "
+				<< largest << ", " << 100.0 * fraction << "% of channels beyond " << VERIFY_TOLERANCE << endl;
+		}
+		if (texture.textureID != 0) DestroyTexture(&texture);
+	}
+	if (tilesReady) tiles.Destroy();
+	graph->Clear();
+
+	cout << (cases - failures) << " of " << cases << " cases match" << endl;
+	return failures == 0;
+}
+
+bool RunBench(const BenchOptions &options, FilterGraph *graph)
+{
+	vector<BenchMode> modes = Modes(options.blurSigma);
+	unique_ptr<WorkPool> pool(new WorkPool(options.cpuThreads));
+	string renderer;
+	bool gpu = options.gpu && graph;
+	if (gpu) renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+	if (options.gpu && !graph)
+		cout << "No OpenGL context, benchmarking the CPU only" << endl;
+
+	cout << "Benchmarking " << modes.size() << " effects";
+	if (gpu) cout << " on " << renderer;
+	if (gpu && options.cpu) cout << " and";
+	if (options.cpu) cout << " on " << pool->Threads() << " CPU threads with " << IsaName(ActiveIsa())
+		<< " kernels";
+	cout << ", " << options.warmup << " warmup runs and up to " << options.trials << " trials each" << endl;
+
+	// the bundled images first, then the synthetic one at every size
+	vector<string> names = options.images;
+	for (int size : options.sizes)
+		names.push_back("synthetic " + to_string(size));
+
+	vector<BenchResult> results;
+	TileRenderer tiles;
+	bool tilesReady = false;
+	int limit = gpu ? min(MaxTextureSize(), SINGLE_PASS_LIMIT) : 0;
+	for (size_t input = 0; input < names.size(); input++) {
+		const string &name = names[input];
+		shared_ptr<DecodedImage> image = input < options.images.size()
+			? DecodeImage(name.c_str()) : SyntheticImage(options.sizes[input - options.images.size()]);
+		if (!image || !image->pixels) {
+			cout << "Unable to load " << name << endl;
+			continue;
+		}
+		bool tiled = image->width > limit || image->height > limit;
+
+		MyTexture texture;
+		if (gpu && !tiled && !InitializeTexture(&texture, *image, GL_TEXTURE_RECTANGLE)) {
+			cout << "Unable to upload " << name << endl;
+			continue;
+		}
+		vector<unsigned char> output;
+		if (options.cpu) output.resize(size_t(image->width) * image->height * 3);
+
+		for (int backend = 0; backend < 2; backend++) {
+			bool onGpu = backend == 0;
+			if (onGpu ? !gpu : !options.cpu) continue;
+			for (const BenchMode &mode : modes) {
+				vector<FilterStage> stages(1, mode.stage);
+				function<bool()> run;
+				if (onGpu && tiled) {
+					run = [&] {
+						if (!tilesReady) tilesReady = tiles.Initialize();
+						if (!tilesReady || !tiles.Begin(image, stages)) return false;
+						while (!tiles.Step(true));
+						return !tiles.Failed();
+					};
+				}
+				else if (onGpu) {
+					graph->Clear();
+					graph->AddStage(mode.stage);
+					run = [&] {
+						graph->Invalidate();
+						const MyTexture &filtered = graph->Run(texture);
+						glFinish();
+						return filtered.textureID != texture.textureID;
+					};
+				}
+				else {
+					run = [&] {
+						StreamCpuStages(stages, image->pixels, image->width, image->height,
+							image->components, output.data(), 3, pool.get());
+						return true;
+					};
+				}
+
+				BenchResult result;
+				result.backend = onGpu ? "gpu" : "cpu";
+				result.image = name;
+				result.filter = StageName(mode.stage);
+				result.key = mode.key;
+				result.width = image->width;
+				result.height = image->height;
+				result.tiled = onGpu && tiled;
+				if (!TimeCase(options, run, &result.ms)) {
+					cout << result.backend << " " << name << " " << result.filter << ": failed" << endl;
+					continue;
+				}
+				cout << result.backend << " " << name << " (" << result.width << "x" << result.height
+					<< (result.tiled ? ", tiled" : "") << ") " << result.filter << ": median "
+					<< Median(result.ms) << " ms, p95 " << Percentile(result.ms, 0.95) << " ms, "
+					<< Throughput(result) << " MP/s over " << result.ms.size() << " trials" << endl;
+				results.push_back(result);
+			}
+		}
+		if (texture.textureID != 0) DestroyTexture(&texture);
+	}
+	if (tilesReady) tiles.Destroy();
+	if (graph) graph->Clear();
+
+	if (!WriteResults(options, renderer, pool->Threads(), results)) {
+		cout << "Unable to write benchmark results to " << options.output << endl;
+		return false;
+	}
+	cout << "Wrote " << results.size() << " benchmark results to " << options.output << endl;
+	return true;
+}
@@ -0,0 +1,67 @@
+// ==========================================================================
+// Benchmark of every effect on both backends
+//
+// Each effect the viewer's keys select is run on its own over the bundled
+// images at their own size and over a synthetic image at a range of square
+// sizes, on the GPU through the filter graph and on the CPU engine. Every
+// case is run a few times to warm up, then timed over repeated trials, and
+// the median, 95th percentile and megapixels per second of the median are
+// printed and written to a JSON file, so runs on different builds can be
+// compared to catch regressions. The same inputs also check that the CPU
+// engine's output matches the GPU's.
+// ==========================================================================
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+
+#include "filtergraph.h"
+
+struct BenchOptions
+{
+	std::vector<std::string> images;	// run at their own size
+	std::vector<int> sizes;				// edges of the synthetic images
+	int warmup;							// untimed runs before the trials
+	int trials;
+	double caseSeconds;					// fewer trials once a case took this long,
+										// but never fewer than MIN_BENCH_TRIALS
+	bool gpu;
+	bool cpu;
+	unsigned cpuThreads;				// zero for all cores
+	float blurSigma;					// of the adjustable Gaussian
+	std::string output;
+
+	BenchOptions() : warmup(2), trials(10), caseSeconds(10.0), gpu(true), cpu(true),
+		cpuThreads(0), blurSigma(4.f), output("bench.json")
+	{}
+};
+
+const int MIN_BENCH_TRIALS = 3;
+
+// the CPU output may differ from the GPU's by VERIFY_TOLERANCE levels of 255
+// per channel, from rounding and the GPU's half float targets, except in a
+// VERIFY_OUTLIERS fraction of channels, where a threshold such as the
+// grunge effect's may land on the other side
+const int VERIFY_TOLERANCE = 2;
+const double VERIFY_OUTLIERS = 0.001;
+
+// the bundled images and sizes from 256 to 16384 benchmarked by default
+void DefaultBenchInputs(BenchOptions *options);
+
+// parses a comma separated list of sizes such as "256,1024", returning false
+// and leaving sizes unchanged if an entry is not a positive number
+bool ParseBenchSizes(const std::string &list, std::vector<int> *sizes);
+
+// runs every case; the GPU cases need graph initialized in a current OpenGL
+// context and are skipped if it is null. Returns false if the results could
+// not be written
+bool RunBench(const BenchOptions &options, FilterGraph *graph);
+
+// runs every effect once on both backends over the same inputs and compares
+// the CPU output with the GPU readback, printing the largest difference of
+// each case; graph must be initialized. Returns false if any case differs
+// by more than the tolerance above
+bool VerifyBackends(const BenchOptions &options, FilterGraph *graph);
+
+#endif
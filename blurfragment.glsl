@@ -0,0 +1,40 @@
+// ==========================================================================
+// Fragment program for one direction of a separable Gaussian blur
+//
+// Run once with a horizontal direction and once with a vertical one, the
+// two passes together apply the outer product of the 1D weights. Each tap
+// past the centre is a linear fetch between two texels, so it picks up both
+// of their weights at once.
+// ==========================================================================
+#version 410
+
+// must match MAX_BLUR_TAPS in blurpass.h
+#define MAX_TAPS 33
+
+in vec2 textureCoords;
+
+out vec4 FragmentColour;
+
+uniform sampler2DRect tex;
+
+// one texel step along the blur axis
+uniform vec2 direction;
+
+// taps[0] is the centre; taps[i].x is the offset in texels of a fetch made on
+// both sides of the centre and taps[i].y the weight of each
+layout(std140) uniform BlurKernel
+{
+	int tapCount;
+	vec4 taps[MAX_TAPS];
+};
+
+void main(void)
+{
+	vec4 colour = texture(tex, textureCoords) * taps[0].y;
+	for (int i = 1; i < tapCount; i++) {
+		vec2 offset = taps[i].x * direction;
+		colour += texture(tex, textureCoords + offset) * taps[i].y;
+		colour += texture(tex, textureCoords - offset) * taps[i].y;
+	}
+	FragmentColour = colour;
+}
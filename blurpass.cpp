@@ -0,0 +1,107 @@
+// ==========================================================================
+// Separable Gaussian blur rendered into offscreen targets
+// ==========================================================================
+
+#include "blurpass.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+bool InitializeBlurPass(BlurPass *pass)
+{
+	if (!InitializeShaders(&pass->shader, "passvertex.glsl", "blurfragment.glsl"))
+		return false;
+	GLuint program = pass->shader.program;
+	pass->directionLocation = glGetUniformLocation(program, "direction");
+	GLuint kernelIndex = glGetUniformBlockIndex(program, "BlurKernel");
+	if (kernelIndex != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, kernelIndex, BLUR_KERNEL_BINDING);
+
+	glGenBuffers(1, &pass->kernelBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, pass->kernelBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(BlurKernel), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	return !CheckGLErrors();
+}
+
+void DestroyBlurPass(BlurPass *pass)
+{
+	DestroyShaders(&pass->shader);
+	glDeleteBuffers(1, &pass->kernelBuffer);
+	pass->kernelBuffer = 0;
+	pass->kernelType = 0;
+}
+
+void ComputeBlurTaps(BlurKernel *kernel, const float *weights, int weightCount)
+{
+	int radius = min(weightCount - 1, MAX_BLUR_RADIUS);
+
+	// the centre texel is fetched on its own, then each pair of texels at
+	// distances i and i + 1 becomes one linear fetch at their weighted mean
+	// offset, which the texture unit splits back into the two weights
+	int n = 0;
+	kernel->taps[n][0] = 0.f;
+	kernel->taps[n][1] = weights[0];
+	n++;
+	for (int i = 1; i <= radius; i += 2) {
+		float w0 = weights[i];
+		float w1 = i + 1 <= radius ? weights[i + 1] : 0.f;
+		float w = w0 + w1;
+		if (w <= 0.f) continue;
+		kernel->taps[n][0] = (i * w0 + (i + 1) * w1) / w;
+		kernel->taps[n][1] = w;
+		n++;
+	}
+	kernel->tapCount = n;
+}
+
+// uploads the kernel for this blur if it differs from the one in the buffer
+static void UpdateKernel(BlurPass *pass, int blurType, float sigma)
+{
+	if (blurType != GAUSSIAN_BLUR) sigma = 0.f;
+	if (pass->kernelType == blurType && pass->kernelSigma == sigma) return;
+
+	BlurKernel kernel;
+	vector<float> weights = BlurWeights(blurType, sigma);
+	ComputeBlurTaps(&kernel, weights.data(), int(weights.size()));
+
+	glBindBuffer(GL_UNIFORM_BUFFER, pass->kernelBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(BlurKernel), &kernel);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	pass->kernelType = blurType;
+	pass->kernelSigma = sigma;
+}
+
+// draws the source through the blur program into a target along one axis
+static void BlurAxis(BlurPass *pass, const MyTexture &source, MyFramebuffer *target,
+	const MyGeometry &quad, GLfloat dx, GLfloat dy)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	glUniform2f(pass->directionLocation, dx, dy);
+	glBindTexture(source.target, source.textureID);
+	glDrawArrays(GL_TRIANGLES, 0, quad.elementCount);
+	glBindTexture(source.target, 0);
+}
+
+void RenderBlur(BlurPass *pass, const MyTexture &source, MyFramebuffer *scratch,
+	MyFramebuffer *target, const MyGeometry &quad, int blurType, float sigma)
+{
+	if (blurType == GAUSSIAN_BLUR) sigma = max(sigma, 0.5f);
+	UpdateKernel(pass, blurType, sigma);
+
+	// every filter graph has its own blur pass, so the binding point is
+	// claimed each time rather than once
+	glBindBufferBase(GL_UNIFORM_BUFFER, BLUR_KERNEL_BINDING, pass->kernelBuffer);
+	glUseProgram(pass->shader.program);
+	glBindVertexArray(quad.vertexArray);
+
+	BlurAxis(pass, source, scratch, quad, 1.f, 0.f);
+	BlurAxis(pass, scratch->texture, target, quad, 0.f, 1.f);
+
+	// reset state to default
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,71 @@
+// ==========================================================================
+// Separable Gaussian blur rendered into offscreen targets
+//
+// The blur runs at image resolution as a horizontal pass into a scratch
+// target followed by a vertical pass into the output, costing 2N texture
+// fetches per pixel instead of the N*N the square kernels needed. The filter
+// graph supplies both targets and runs the blur as one of its stages.
+//
+// The 1D weights are computed on the host whenever the blur changes and
+// uploaded to a uniform buffer. Neighbouring pairs of weights are merged into
+// one bilinear fetch placed between the two texels, which halves the number
+// of taps for any radius.
+// ==========================================================================
+#ifndef BLURPASS_H
+#define BLURPASS_H
+
+#include "boilerplate.h"
+#include "filterkernels.h"
+
+// uniform buffer binding point of the BlurKernel block
+const GLuint BLUR_KERNEL_BINDING = 1;
+
+// number of merged taps the largest radius needs; the taps array size must
+// match MAX_TAPS in blurfragment.glsl
+const int MAX_BLUR_TAPS = 1 + MAX_BLUR_RADIUS / 2;
+
+// mirrors the std140 BlurKernel uniform block; each tap holds the offset in
+// texels of a fetch from the centre and the weight applied to it, padded to
+// a vec4 as std140 requires for array elements
+struct BlurKernel
+{
+	GLint   tapCount;
+	GLint   padding[3];
+	GLfloat taps[MAX_BLUR_TAPS][4];
+
+	BlurKernel() : tapCount(0)
+	{}
+};
+
+struct BlurPass
+{
+	MyShader shader;
+
+	// uniform locations resolved once after linking
+	GLint directionLocation;
+
+	// kernel currently in the uniform buffer, recomputed only when the blur
+	// type or sigma changes
+	GLuint kernelBuffer;
+	int kernelType;
+	float kernelSigma;
+
+	BlurPass() : directionLocation(-1), kernelBuffer(0), kernelType(0), kernelSigma(0.f)
+	{}
+};
+
+bool InitializeBlurPass(BlurPass *pass);
+void DestroyBlurPass(BlurPass *pass);
+
+// fills the kernel with merged taps for 1D weights given from the centre
+// outwards, weights[0] being the centre; the radius is weightCount - 1
+void ComputeBlurTaps(BlurKernel *kernel, const float *weights, int weightCount);
+
+// blurs the source into the target with the 3x3, 5x5 or 7x7 Gaussian
+// selected by blurType (1 to 3) or, for GAUSSIAN_BLUR, one of the given sigma
+// in texels; the scratch target, the output target and the viewport must all
+// match the source size, and the quad must cover the viewport
+void RenderBlur(BlurPass *pass, const MyTexture &source, MyFramebuffer *scratch,
+	MyFramebuffer *target, const MyGeometry &quad, int blurType, float sigma);
+
+#endif
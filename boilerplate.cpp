@@ -15,23 +15,43 @@
 #include <algorithm>
 #include <string>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include "glm/glm.hpp"
 #include <iterator>
-
-// specify that we want the OpenGL core profile before including GLFW headers
-#define GLFW_INCLUDE_GLCOREARB
-#define GL_GLEXT_PROTOTYPES
-#include <GLFW/glfw3.h>
+#include "boilerplate.h"
+#include "imagecache.h"
+#include "decodepool.h"
+#include "textureupload.h"
+#include "resources.h"
+#include "filtergraph.h"
+#include "batch.h"
+#include "bench.h"
+#include "cpufilters.h"
+#include "exporter.h"
+#include "tilerender.h"
+#include "gputimer.h"
+#include "perfmonitor.h"
+#include "hud.h"
+#include "loadprofile.h"
+#include "programbinary.h"
+#include "trace.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb_image_write.h>
 
 using namespace std;
 using namespace glm;
 
 const char* image_name = " ";
+
+// every image the viewer can show, in the order of the number keys
+const char* image_names[] = { "test.jpg", "mandrill.png", "uclogo.png",
+	"aerial.jpg", "thirsk.jpg", "pattern.png" };
+const int image_count = sizeof(image_names) / sizeof(image_names[0]);
 float zoom = 1.f;
 float rotat = 0.f;
 bool space = false;
@@ -43,45 +63,74 @@ float mouse_endX = 0.f;
 float mouse_endY = 0.f;
 bool drag = false;
 
-// --------------------------------------------------------------------------
-// OpenGL utility and support function prototypes
+// set by anything that changes what is on screen; in on-demand mode the
+// main loop sleeps until this is set instead of redrawing continuously
+bool frameDirty = true;
 
-void QueryGLVersion();
-bool CheckGLErrors();
+// times every pass on the GPU and the main CPU work, shown on the HUD while
+// it is visible and written to perfDumpPath on exit if one was given
+GpuTimer gpuTimer;
+PerfMonitor perfMonitor;
+HudOverlay hud;
+bool hudVisible = false;
+string perfDumpPath;
 
-string LoadSource(const string &filename);
-GLuint CompileShader(GLenum shaderType, const string &source);
-GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader);
+// linked programs saved on disk, so later launches skip compiling them;
+// shaderCachePath is empty if the cache was turned off
+ProgramBinaryCache programBinaries;
+string shaderCachePath = "shadercache";
 
-// --------------------------------------------------------------------------
-// Functions to set up OpenGL shader programs for rendering
+// where trace events are written on exit, if tracing was asked for
+string tracePath;
 
-struct MyShader
+void WriteTrace()
 {
-	// OpenGL names for vertex and fragment shaders, shader program
-	GLuint  vertex;
-	GLuint  fragment;
-	GLuint  program;
+	TraceWrite(tracePath);
+}
 
-	// initialize shader and program names to zero (OpenGL reserved value)
-	MyShader() : vertex(0), fragment(0), program(0)
-	{}
-};
+// --------------------------------------------------------------------------
+// Functions to set up OpenGL shader programs for rendering
 
 // load, compile, and link shaders, returning true if successful
-bool InitializeShaders(MyShader *shader)
+bool InitializeShaders(MyShader *shader, const string &vertexFile, const string &fragmentFile,
+	const string &defines)
 {
+	TRACE_SCOPE("InitializeShaders");
 	// load shader source from files
-	string vertexSource = LoadSource("vertex.glsl");
-	string fragmentSource = LoadSource("fragment.glsl");
+	string vertexSource = LoadSource(vertexFile);
+	string fragmentSource = LoadSource(fragmentFile);
 	if (vertexSource.empty() || fragmentSource.empty()) return false;
+	vertexSource = InjectDefines(vertexSource, defines);
+	fragmentSource = InjectDefines(fragmentSource, defines);
+
+	// a program restored from a binary has no shader objects, which stay
+	// zero; each combination of files and defines has one cache entry
+	string cacheName = vertexFile + "\n" + fragmentFile + "\n" + defines;
+	shader->program = programBinaries.Load(cacheName, vertexSource, fragmentSource);
+	if (shader->program == 0) {
+		auto start = chrono::steady_clock::now();
+
+		// compile shader source into shader objects
+		shader->vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
+		shader->fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
+
+		// link shader program
+		shader->program = LinkProgram(shader->vertex, shader->fragment, programBinaries.Enabled());
+		GLint linked = GL_FALSE;
+		glGetProgramiv(shader->program, GL_LINK_STATUS, &linked);
+		if (linked == GL_FALSE) return false;
+		programBinaries.RecordCompile(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+		programBinaries.Store(shader->program, cacheName, vertexSource, fragmentSource);
+	}
 
-	// compile shader source into shader objects
-	shader->vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
-	shader->fragment = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
-
-	// link shader program
-	shader->program = LinkProgram(shader->vertex, shader->fragment);
+	// resolve uniforms once, so input handling never looks names up
+	shader->textureLocation = glGetUniformLocation(shader->program, "tex");
+	shader->viewStateIndex = glGetUniformBlockIndex(shader->program, "ViewState");
+	if (shader->viewStateIndex != GL_INVALID_INDEX)
+		glUniformBlockBinding(shader->program, shader->viewStateIndex, VIEW_STATE_BINDING);
+	glUseProgram(shader->program);
+	glUniform1i(shader->textureLocation, 0);
+	glUseProgram(0);
 
 	// check for OpenGL errors and return false if error occurred
 	return !CheckGLErrors();
@@ -100,30 +149,22 @@ void DestroyShaders(MyShader *shader)
 // --------------------------------------------------------------------------
 // Functions to set up OpenGL buffers for storing textures
 
-struct MyTexture
+// uploads already decoded pixels into a new texture object
+bool InitializeTexture(MyTexture* texture, const DecodedImage &image, GLuint target)
 {
-	GLuint textureID;
-	GLuint target;
-	int width;
-	int height;
-
-	// initialize object names to zero (OpenGL reserved value)
-	MyTexture() : textureID(0), target(0), width(0), height(0)
-	{}
-};
-
-bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target = GL_TEXTURE_2D)
-{
-	int numComponents;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(filename, &texture->width, &texture->height, &numComponents, 0);
-	if (data != nullptr)
+	TRACE_SCOPE("InitializeTexture");
+	if (image.pixels != nullptr)
 	{
+		texture->width = image.width;
+		texture->height = image.height;
 		texture->target = target;
 		glGenTextures(1, &texture->textureID);
 		glBindTexture(texture->target, texture->textureID);
-		GLuint format = numComponents == 3 ? GL_RGB : GL_RGBA;
-		glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, data);
+		GLuint format = TextureFormat(image.components);
+		texture->format = format;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(texture->target, 0, format, texture->width, texture->height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
 		// Note: Only wrapping modes supported for GL_TEXTURE_RECTANGLE when defining
 		// GL_TEXTURE_WRAP are GL_CLAMP_TO_EDGE or GL_CLAMP_TO_BORDER
@@ -134,45 +175,102 @@ bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target =
 
 		// Clean up
 		glBindTexture(texture->target, 0);
-		stbi_image_free(data);
 		return !CheckGLErrors();
 	}
-	return true; //error
+	return false;
+}
+
+bool InitializeTexture(MyTexture* texture, const char* filename, GLuint target, LoadProfile *profile)
+{
+	TRACE_SCOPE("InitializeTexture file");
+	shared_ptr<DecodedImage> image = DecodeImage(filename, profile);
+	if (!image) return false;
+	if (!profile) return InitializeTexture(texture, *image, target);
+
+	// glTexImage2D may return before the pixels are copied, so finish the
+	// queue first and then wait for the upload alone
+	glFinish();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool uploaded = InitializeTexture(texture, *image, target);
+	glFinish();
+	profile->uploadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return uploaded;
+}
+
+// approximate video memory held by a texture, assuming RGB is padded to RGBA
+size_t TextureBytes(const MyTexture &texture)
+{
+	return size_t(texture.width) * texture.height * 4;
 }
 
 // deallocate texture-related objects
 void DestroyTexture(MyTexture *texture)
 {
+	if (texture->textureID == 0) return;
 	glBindTexture(texture->target, 0);
 	glDeleteTextures(1, &texture->textureID);
 }
 
-void SaveImage(const char* filename, int width, int height, unsigned char *data, int numComponents = 3, int stride = 0)
+// create a render target, or resize an existing one if its size differs
+bool InitializeFramebuffer(MyFramebuffer *target, int width, int height, GLenum internalFormat)
 {
-	if (!stbi_write_png(filename, width, height, numComponents, data, stride))
-		cout << "Unable to save image: " << filename << endl;
+	MyTexture &texture = target->texture;
+	if (target->framebuffer != 0 && texture.width == width && texture.height == height
+		&& texture.format == internalFormat)
+		return true;
+	DestroyFramebuffer(target);
+
+	texture.target = GL_TEXTURE_RECTANGLE;
+	texture.format = internalFormat;
+	texture.width = width;
+	texture.height = height;
+	glGenTextures(1, &texture.textureID);
+	glBindTexture(texture.target, texture.textureID);
+	glTexImage2D(texture.target, 0, internalFormat, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+	glTexParameteri(texture.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(texture.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(texture.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(texture.target, 0);
+
+	glGenFramebuffers(1, &target->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture.target, texture.textureID, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		cout << "ERROR: Framebuffer incomplete (status " << status << ")" << endl;
+		return false;
+	}
+	return !CheckGLErrors();
 }
 
-// --------------------------------------------------------------------------
-// Functions to set up OpenGL buffers for storing geometry data
+void DestroyFramebuffer(MyFramebuffer *target)
+{
+	if (target->framebuffer != 0)
+		glDeleteFramebuffers(1, &target->framebuffer);
+	DestroyTexture(&target->texture);
+	*target = MyFramebuffer();
+}
 
-struct MyGeometry
+bool SaveImage(const char* filename, int width, int height, const unsigned char *data, int numComponents,
+	int stride, const WriteOptions &options, WriteStats *stats)
 {
-	// OpenGL names for array buffer objects, vertex array object
-	GLuint  vertexBuffer;
-	GLuint  textureBuffer;
-	GLuint  colourBuffer;
-	GLuint  vertexArray;
-	GLsizei elementCount;
+	TRACE_SCOPE("SaveImage");
+	if (!WriteImage(filename, width, height, data, numComponents, stride, options, stats)) {
+		cout << "Unable to save image: " << filename << endl;
+		return false;
+	}
+	return true;
+}
 
-	// initialize object names to zero (OpenGL reserved value)
-	MyGeometry() : vertexBuffer(0), colourBuffer(0), vertexArray(0), elementCount(0)
-	{}
-};
+// --------------------------------------------------------------------------
+// Functions to set up OpenGL buffers for storing geometry data
 
 // create buffers and fill with geometry data, returning true if successful
 bool InitializeGeometry(MyGeometry *geometry, float height, float width)
 {
+	TRACE_SCOPE("InitializeGeometry");
 	float x = 1.f;
 	float y = 1.f;
 
@@ -181,7 +279,14 @@ bool InitializeGeometry(MyGeometry *geometry, float height, float width)
 
 	else if(width > height)
 		y = (height / width);
-	
+
+	return InitializeQuad(geometry, x, y, width, height);
+}
+
+// create or update a quad spanning [-x, x] by [-y, y] in clip space whose
+// texture coordinates cover a rectangle texture of the given size
+bool InitializeQuad(MyGeometry *geometry, float x, float y, float width, float height)
+{
 	// three vertex positions and assocated colours of a triangle
 	const GLfloat vertices[][2] = {
 
@@ -207,6 +312,17 @@ bool InitializeGeometry(MyGeometry *geometry, float height, float width)
 	const GLfloat colours[][3] = {};
 	geometry->elementCount = 6;
 
+	// switching images only changes the quad's shape, so overwrite the
+	// buffers created the first time instead of allocating new ones
+	if (geometry->vertexArray != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, geometry->vertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+		glBindBuffer(GL_ARRAY_BUFFER, geometry->textureBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(textureCoords), textureCoords);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return !CheckGLErrors();
+	}
+
 	// these vertex attribute indices correspond to those specified for the
 	// input variables in the vertex shader
 	const GLuint VERTEX_INDEX = 0;
@@ -262,29 +378,117 @@ void DestroyGeometry(MyGeometry *geometry)
 	glBindVertexArray(0);
 	glDeleteVertexArrays(1, &geometry->vertexArray);
 	glDeleteBuffers(1, &geometry->vertexBuffer);
+	glDeleteBuffers(1, &geometry->textureBuffer);
 	glDeleteBuffers(1, &geometry->colourBuffer);
+	*geometry = MyGeometry();
+}
+
+// --------------------------------------------------------------------------
+// Functions to set up the uniform buffer holding view and filter parameters
+
+// host copy of the ViewState uniform block; input callbacks only edit this
+// copy, and any changes are uploaded together once per frame
+ViewState viewState;
+ViewState uploadedViewState;
+GLuint viewStateBuffer = 0;
+
+bool InitializeViewState()
+{
+	glGenBuffers(1, &viewStateBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, viewStateBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewState), &viewState, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, VIEW_STATE_BINDING, viewStateBuffer);
+	uploadedViewState = viewState;
+	return !CheckGLErrors();
+}
+
+void UpdateViewState()
+{
+	if (memcmp(&viewState, &uploadedViewState, sizeof(ViewState)) == 0) return;
+	glBindBuffer(GL_UNIFORM_BUFFER, viewStateBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ViewState), &viewState);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	uploadedViewState = viewState;
+}
+
+void DestroyViewState()
+{
+	glDeleteBuffers(1, &viewStateBuffer);
+	viewStateBuffer = 0;
 }
 
 // --------------------------------------------------------------------------
 // Rendering function that draws our scene to the frame buffer
 
+// effects applied to the image in image space before it is drawn
+FilterGraph filterGraph;
+
+// standard deviation in texels of the adjustable Gaussian blur
+float blurSigma = 4.f;
+
+// stages appended with Shift held; while empty, the graph applies the one
+// blur, filter and colour effect selected by the keys, in that order
+vector<FilterStage> customStages;
+
+void BuildFilterGraph()
+{
+	filterGraph.Clear();
+	if (customStages.empty()) {
+		if (viewState.blurType != 0)
+			filterGraph.AddStage(FilterStage(FilterStage::BLUR, viewState.blurType, blurSigma));
+		if (viewState.filterType != 0)
+			filterGraph.AddStage(FilterStage(FilterStage::KERNEL, viewState.filterType));
+		if (viewState.greyScale != 0)
+			filterGraph.AddStage(FilterStage(FilterStage::COLOUR, viewState.greyScale));
+	}
+	for (const FilterStage &stage : customStages)
+		filterGraph.AddStage(stage);
+
+	// hue changes apply last, and only once any of them is non-zero
+	if (viewState.hue && (viewState.redFilter != 0.f || viewState.greenFilter != 0.f
+		|| viewState.blueFilter != 0.f)) {
+		FilterStage stage(FilterStage::HUE);
+		stage.hue[0] = viewState.redFilter;
+		stage.hue[1] = viewState.greenFilter;
+		stage.hue[2] = viewState.blueFilter;
+		filterGraph.AddStage(stage);
+	}
+}
+
 void RenderScene(MyGeometry *geometry, MyTexture* texture, MyShader *shader)
 {
+	TRACE_SCOPE("RenderScene");
 	// clear screen to a dark grey colour
 	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	// nothing to draw until the first image has been decoded
+	if (texture->textureID == 0) return;
+
+	UpdateViewState();
+
+	// run the effects into an offscreen target at image resolution, which is
+	// only redone when the image or the effects change; moving the view just
+	// draws that target again
+	BuildFilterGraph();
+	const MyTexture &source = filterGraph.Run(*texture);
+
 	// bind our shader program and the vertex array object containing our
 	// scene geometry, then tell OpenGL to draw our geometry
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	gpuTimer.Begin("display", viewport[2] * double(viewport[3]) * 1e-6);
 	glUseProgram(shader->program);
 	glBindVertexArray(geometry->vertexArray);
-	glBindTexture(texture->target, texture->textureID);
+	glBindTexture(source.target, source.textureID);
 	glDrawArrays(GL_TRIANGLES, 0, geometry->elementCount);
 
 	// reset state to default (no shader or geometry bound)
-	glBindTexture(texture->target, 0);
+	glBindTexture(source.target, 0);
 	glBindVertexArray(0);
 	glUseProgram(0);
+	gpuTimer.End();
 
 	// check for an report any OpenGL errors
 	CheckGLErrors();
@@ -297,6 +501,44 @@ MyShader shader;
 MyGeometry geometry;
 MyTexture texture;
 
+// owner of every image texture, counting live video memory against a budget
+GpuResources resources(768u << 20);
+
+// decoded pixels and uploaded textures for recently viewed images, so that
+// switching back to an image skips the decode and upload entirely; evicted
+// textures go back to the resource manager for reuse
+LruCache<shared_ptr<DecodedImage>> imageCache(256u << 20);
+LruCache<MyTexture> textureCache(512u << 20, [](MyTexture &t) { resources.ReleaseTexture(&t); });
+
+// key of the texture on screen, which must never be evicted
+string displayedKey;
+
+// worker threads decoding images in the background, the image waiting to be
+// shown once its decode finishes, and decoded images not yet uploaded
+unique_ptr<DecodePool> decodePool;
+string pendingImage;
+deque<DecodeResult> uploadQueue;
+
+// streams one image at a time into a texture over several frames; the key
+// identifies the image and uploadShows is set if it should be displayed
+TextureUploader uploader;
+string uploadKey;
+shared_ptr<DecodedImage> uploadImage;
+bool uploadShows = false;
+
+// the full image on screen when only its preview fits in a texture; exports
+// of it are filtered in tiles from these pixels
+shared_ptr<DecodedImage> displayedImage;
+TileRenderer tileRenderer;
+string tileExportPath;
+bool tileExportReady = false;	// filtered, waiting for the exporter
+
+// writes the filtered image at full resolution in the background; exports
+// are numbered so repeated ones do not overwrite each other
+ImageExporter exporter;
+int exportCount = 0;
+WriteOptions writeOptions;
+
 float redFilter = 0.f;
 float blueFilter = 0.f;
 float greenFilter = 0.f;
@@ -312,40 +554,320 @@ void ErrorCallback(int error, const char* description)
 	cout << description << endl;
 }
 
-void reInit(){
-	if(!InitializeTexture(&texture, image_name, GL_TEXTURE_RECTANGLE))
+// starts streaming a decoded image into a texture; an upload the user is
+// waiting for replaces a speculative one, but not the other way around
+void StartUpload(const string &key, const string &name, const shared_ptr<DecodedImage> &image, bool show)
+{
+	if (uploader.Active()) {
+		if (uploadKey == key) {
+			uploadShows = uploadShows || show;
+			return;
+		}
+		if (uploadShows && !show) return;
+		MyTexture abandoned = uploader.Cancel();
+		resources.ReleaseTexture(&abandoned);
+	}
+	// an image too large for a texture is shown through its preview
+	const shared_ptr<DecodedImage> &shown = image->preview ? image->preview : image;
+	MyTexture storage = resources.AcquireTexture(GL_TEXTURE_RECTANGLE,
+		TextureFormat(shown->components), shown->width, shown->height);
+	if (!uploader.Begin(shown, GL_TEXTURE_RECTANGLE, name, storage)) {
 		cout << "Program failed to intialize texture!" << endl;
+		resources.ReleaseTexture(&storage);
+		return;
+	}
+	uploadKey = key;
+	uploadImage = image;
+	uploadShows = show;
+}
+
+void reInit(){
+	string key = ImageKey(image_name);
+	if (!textureCache.Find(key, &texture)) {
+		shared_ptr<DecodedImage> image;
+		pendingImage = image_name;
+		// keep showing the current image until this one has been decoded by
+		// the pool and streamed to the GPU
+		if (imageCache.Find(key, &image))
+			StartUpload(key, image_name, image, true);
+		else
+			decodePool->Request(image_name, true);
+		return;
+	}
+	pendingImage.clear();
+	displayedKey = key;
+	displayedImage.reset();
+	imageCache.Find(key, &displayedImage);
+	filterGraph.Invalidate();
 	if (!InitializeGeometry(&geometry, texture.height, texture.width))
 		cout << "Program failed to intialize geometry!" << endl;
 }
 
+void PrintUploadStats(const UploadStats &stats)
+{
+	cout << "Uploaded " << stats.name << " (" << stats.width << "x" << stats.height << ", "
+		<< (stats.bytes >> 10) << " KB) in " << stats.bands << " bands over " << stats.frames
+		<< " frames: " << stats.seconds * 1000.0 << " ms total, " << stats.copySeconds * 1000.0
+		<< " ms copying, " << (stats.persistent ? "persistent" : "orphaned") << " buffers" << endl;
+}
+
+// advances the texture upload in progress by one band, and once it is done
+// either displays it or starts the next speculative upload
+void ProcessUploads()
+{
+	TRACE_SCOPE("ProcessUploads");
+	if (!uploader.Active()) {
+		while (!uploadQueue.empty()) {
+			DecodeResult next = uploadQueue.front();
+			uploadQueue.pop_front();
+			// speculative uploads must never evict, or they could free the
+			// texture that is currently on screen
+			const CacheStats &stats = textureCache.Stats();
+			const DecodedImage &shown = next.image->preview ? *next.image->preview : *next.image;
+			size_t bytes = size_t(shown.width) * shown.height * 4;
+			if (!textureCache.Contains(next.key) && stats.bytes + bytes <= stats.budget) {
+				StartUpload(next.key, next.path, next.image, false);
+				break;
+			}
+		}
+		if (!uploader.Active()) return;
+	}
+
+	if (!uploader.Step()) return;
+	const UploadStats &uploadStats = uploader.Stats();
+	PrintUploadStats(uploadStats);
+	perfMonitor.Add(PERF_CPU, "upload", uploadStats.seconds * 1000.0,
+		uploadStats.width * double(uploadStats.height) * 1e-6);
+	shared_ptr<DecodedImage> image = uploadImage;
+	uploadImage.reset();
+
+	// an upload nobody waits for any more, such as one the user switched
+	// away from, is as speculative as a background one and must not evict;
+	// the texture on screen is never evicted either way
+	MyTexture uploaded = uploader.Texture();
+	const CacheStats &stats = textureCache.Stats();
+	bool shows = uploadShows && pendingImage == uploader.Name();
+	if (!shows && stats.bytes + TextureBytes(uploaded) > stats.budget) {
+		resources.ReleaseTexture(&uploaded);
+		return;
+	}
+	textureCache.Insert(uploadKey, uploaded, TextureBytes(uploaded), displayedKey);
+	if (shows) {
+		texture = uploaded;
+		displayedKey = uploadKey;
+		displayedImage = image;
+		filterGraph.Invalidate();
+		pendingImage.clear();
+		frameDirty = true;
+		if (!InitializeGeometry(&geometry, texture.height, texture.width))
+			cout << "Program failed to intialize geometry!" << endl;
+	}
+}
+
+// collects images finished by the decode pool, starting the upload of the
+// one waiting for display and queueing the rest for speculative upload so
+// that first-time switches find their texture ready
+void ProcessDecodedImages()
+{
+	TRACE_SCOPE("ProcessDecodedImages");
+	DecodeResult result;
+	while (decodePool->Poll(&result)) {
+		if (!result.image) {
+			cout << "Program failed to decode " << result.path << endl;
+			if (result.path == pendingImage)
+				pendingImage.clear();
+			continue;
+		}
+		perfMonitor.Add(PERF_CPU, "decode", result.seconds * 1000.0,
+			result.image->width * double(result.image->height) * 1e-6);
+		imageCache.Insert(result.key, result.image, result.image->ByteSize());
+		if (result.path == pendingImage)
+			reInit();
+		else
+			uploadQueue.push_back(result);
+	}
+}
+
+// starts exporting the image on screen with its effects, as <name>-N.png in
+// the current directory
+void ExportImage()
+{
+	if (texture.textureID == 0) return;
+	if (exporter.Busy() || tileRenderer.Active() || tileExportReady) {
+		cout << "Still exporting " << (tileRenderer.Active() || tileExportReady ? tileExportPath : exporter.Stats().path) << endl;
+		return;
+	}
+	UpdateViewState();
+	BuildFilterGraph();
+	const MyTexture &output = filterGraph.Run(texture);
+
+	string name = image_name;
+	size_t dot = name.find_last_of('.');
+	if (dot != string::npos) name.erase(dot);
+	string path = name + "-" + to_string(++exportCount) + "." + FormatExtension(writeOptions.format);
+
+	// only a preview is on screen, so filter the full image tile by tile
+	if (displayedImage && displayedImage->preview) {
+		tileExportPath = path;
+		if (!tileRenderer.Begin(displayedImage, filterGraph.Stages()))
+			cout << "Unable to export " << path << endl;
+		return;
+	}
+	if (!exporter.Begin(output, path))
+		cout << "Unable to export " << path << endl;
+}
+
+void PrintTileStats(const TileStats &stats)
+{
+	cout << "Filtered " << stats.tiles << " tiles of " << stats.tileSize << " pixels with a "
+		<< stats.border << " pixel border over " << stats.frames << " frames in "
+		<< stats.seconds * 1000.0 << " ms, " << stats.waitSeconds * 1000.0 << " ms waiting" << endl;
+}
+
+void PrintExportStats(const ExportStats &stats)
+{
+	const WriteStats &file = stats.file;
+	cout << "Exported " << stats.path << " (" << stats.width << "x" << stats.height << "): "
+		<< stats.issueSeconds * 1000.0 << " ms issuing, readback after " << stats.frames
+		<< " frames and " << stats.readbackSeconds * 1000.0 << " ms, " << file.encodeSeconds * 1000.0
+		<< " ms encoding " << FormatExtension(file.format) << " in " << file.bands << " bands ("
+		<< (file.encodeSeconds > 0.0 ? file.imageBytes / file.encodeSeconds / 1e6 : 0.0) << " MB/s), "
+		<< file.writeSeconds * 1000.0 << " ms writing " << (file.fileBytes >> 10) << " KB" << endl;
+}
+
+void PrintCacheStats(const char *name, const CacheStats &stats)
+{
+	cout << name << " cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+		<< stats.evictions << " evictions, " << stats.entries << " entries using "
+		<< (stats.bytes >> 20) << " of " << (stats.budget >> 20) << " MB" << endl;
+}
+
+void PrintProgramStats(const ProgramCache &programs)
+{
+	const ProgramCacheStats &stats = programs.Stats();
+	cout << "Shader programs: " << programs.Size() << " cached, " << stats.compiles << " compiled, "
+		<< stats.failures << " failed, " << stats.switches << " switches" << endl;
+}
+
+void PrintProgramBinaryStats(const ProgramBinaryStats &stats)
+{
+	if (!programBinaries.Enabled()) return;
+	cout << "Program binaries: " << stats.loads << " loaded in " << stats.loadSeconds * 1000.0 << " ms, "
+		<< stats.misses << " missing or out of date, " << stats.rejected << " rejected by the driver, "
+		<< stats.stores << " saved to " << shaderCachePath << ", " << stats.removed
+		<< " stale files removed" << endl;
+}
+
+// with and without the program binary cache, for comparing the two
+void PrintStartupTime(double seconds)
+{
+	const ProgramBinaryStats &stats = programBinaries.Stats();
+	cout << "Started in " << seconds * 1000.0 << " ms, " << (stats.loadSeconds + stats.compileSeconds) * 1000.0
+		<< " ms of it on shaders: " << stats.compiles << " compiled";
+	if (programBinaries.Enabled())
+		cout << ", " << stats.loads << " loaded from the program binary cache" << endl;
+	else
+		cout << ", program binary cache off" << endl;
+}
+
+void PrintFilterGraphStats(const FilterGraphStats &stats)
+{
+	cout << "Filter graph: rendered " << stats.runs << " times, reused " << stats.reuses
+		<< " times" << endl;
+}
+
+void PrintRenderTargetStats(const RenderTargetStats &stats)
+{
+	cout << "Render targets: " << stats.targets << " allocated using " << (stats.bytes >> 20)
+		<< " MB, " << stats.inUse << " in use, at most " << stats.peakInUse << " at once, "
+		<< stats.allocations << " allocations" << endl;
+}
+
+void PrintFilterChain()
+{
+	cout << "Filter chain:";
+	if (customStages.empty()) cout << " (empty)";
+	for (size_t i = 0; i < customStages.size(); i++)
+		cout << (i == 0 ? " " : " -> ") << StageName(customStages[i]);
+	cout << endl;
+}
+
+// appends the effect of a key pressed with Shift to the custom filter chain,
+// returning false if the key does not select an effect
+bool AppendStage(int key)
+{
+	static const int colourKeys[] = { GLFW_KEY_W, GLFW_KEY_E, GLFW_KEY_R, GLFW_KEY_T, GLFW_KEY_Y, GLFW_KEY_U };
+	static const int kernelKeys[] = { GLFW_KEY_Z, GLFW_KEY_X, GLFW_KEY_C };
+	static const int blurKeys[] = { GLFW_KEY_V, GLFW_KEY_B, GLFW_KEY_N, GLFW_KEY_M };
+
+	bool found = false;
+	for (int i = 0; i < 6 && !found; i++) {
+		if (key == colourKeys[i]) {
+			customStages.push_back(FilterStage(FilterStage::COLOUR, i + 1));
+			found = true;
+		}
+	}
+	for (int i = 0; i < 3 && !found; i++) {
+		if (key == kernelKeys[i]) {
+			customStages.push_back(FilterStage(FilterStage::KERNEL, i + 1));
+			found = true;
+		}
+	}
+	for (int i = 0; i < 4 && !found; i++) {
+		if (key == blurKeys[i]) {
+			customStages.push_back(FilterStage(FilterStage::BLUR, i + 1, blurSigma));
+			found = true;
+		}
+	}
+	if (found) PrintFilterChain();
+	return found;
+}
+
+void PrintResourceStats(const ResourceStats &stats)
+{
+	cout << "GPU memory: " << (stats.liveBytes >> 20) << " of " << (stats.budget >> 20) << " MB, "
+		<< stats.liveTextures << " textures in use, " << stats.spareTextures << " spare, "
+		<< stats.allocations << " allocated, " << stats.reuses << " reused, "
+		<< stats.deletions << " deleted" << endl;
+}
+
 void changeGreyScale(int dora) {
-	glUseProgram(shader.program);
-	GLint loc = glGetUniformLocation(shader.program, "greyScale");
-	if (loc != -1)
-		glUniform1i(loc, dora);
+	viewState.greyScale = dora;
 }
 
 void changeFilterType(int wryeah) {
-	glUseProgram(shader.program);
-	GLint loc = glGetUniformLocation(shader.program, "filterType");
-	if (loc != -1)
-		glUniform1i(loc, wryeah);
+	viewState.filterType = wryeah;
 }
 
 void changeBlurType(int shizaa) {
-	glUseProgram(shader.program);
-	GLint loc = glGetUniformLocation(shader.program, "blurType");
-	if (loc != -1)
-		glUniform1i(loc, shizaa);
+	viewState.blurType = shizaa;
 }
 
 // handles keyboard input events
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	TRACE_SCOPE("KeyCallback");
+	ScopedCpuTimer timer(&perfMonitor, "input");
+	if (action == GLFW_PRESS && (mods & GLFW_MOD_SHIFT) && AppendStage(key)) {
+		frameDirty = true;
+		return;
+	}
 	if (action == GLFW_PRESS) {
 		if (key == GLFW_KEY_ESCAPE)
 			glfwSetWindowShouldClose(window, GL_TRUE);
+		else if (key == GLFW_KEY_K){
+			PrintCacheStats("Image", imageCache.Stats());
+			PrintCacheStats("Texture", textureCache.Stats());
+			PrintResourceStats(resources.Stats());
+			PrintProgramStats(filterGraph.Programs());
+			PrintFilterGraphStats(filterGraph.Stats());
+			PrintRenderTargetStats(filterGraph.PoolStats());
+		}
+		else if (key == GLFW_KEY_I)
+			hudVisible = !hudVisible;
+		else if (key == GLFW_KEY_P){
+			ExportImage();
+		}
 		else if (key == GLFW_KEY_1){
 			image_name = "test.jpg";
 			reInit();
@@ -371,6 +893,10 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 			reInit();
 		}
 		else if (key == GLFW_KEY_Q){
+			if (!customStages.empty()) {
+				customStages.clear();
+				PrintFilterChain();
+			}
 			changeGreyScale(0);
 			changeFilterType(0);
 			changeBlurType(0);
@@ -378,16 +904,9 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 			redFilter = 0.f;
 			blueFilter = 0.f;
 			greenFilter = 0.f;
-			glUseProgram(shader.program);
-			GLint locr = glGetUniformLocation(shader.program, "redFilter");
-			if (locr != -1)
-				glUniform1f(locr, redFilter);
-			GLint locb = glGetUniformLocation(shader.program, "blueFilter");
-			if (locb != -1)
-				glUniform1f(locb, blueFilter);
-			GLint locg = glGetUniformLocation(shader.program, "greenFilter");
-			if (locg != -1)
-				glUniform1f(locg, greenFilter);
+			viewState.redFilter = redFilter;
+			viewState.blueFilter = blueFilter;
+			viewState.greenFilter = greenFilter;
 		}
 		else if (key == GLFW_KEY_W){
 			changeGreyScale(1);
@@ -440,56 +959,50 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 			changeFilterType(0);
 			changeBlurType(3);
 		}
+		else if (key == GLFW_KEY_M){
+			changeFilterType(0);
+			changeBlurType(GAUSSIAN_BLUR);
+		}
+		else if (key == GLFW_KEY_RIGHT_BRACKET){
+			blurSigma = min(blurSigma * 1.25f, MAX_BLUR_RADIUS / 3.f);
+			cout << "Gaussian blur sigma " << blurSigma << " texels" << endl;
+		}
+		else if (key == GLFW_KEY_LEFT_BRACKET){
+			blurSigma = max(blurSigma / 1.25f, 0.5f);
+			cout << "Gaussian blur sigma " << blurSigma << " texels" << endl;
+		}
 		else if (key == GLFW_KEY_UP){
 			if (red){
 				if (redFilter < 1.f)
 					redFilter += 0.05f;
-				glUseProgram(shader.program);
-				GLint loc = glGetUniformLocation(shader.program, "redFilter");
-				if (loc != -1)
-					glUniform1f(loc, redFilter);
+				viewState.redFilter = redFilter;
 			}
 			if (blue){
 				if (blueFilter < 1.f)
 					blueFilter += 0.05f;
-				glUseProgram(shader.program);
-				GLint loc = glGetUniformLocation(shader.program, "blueFilter");
-				if (loc != -1)
-					glUniform1f(loc, blueFilter);
+				viewState.blueFilter = blueFilter;
 			}
 			if (green){
 				if (greenFilter < 1.f)
 					greenFilter += 0.05f;
-				glUseProgram(shader.program);
-				GLint loc = glGetUniformLocation(shader.program, "greenFilter");
-				if (loc != -1)
-					glUniform1f(loc, greenFilter);
+				viewState.greenFilter = greenFilter;
 			}
 		}
 		else if (key == GLFW_KEY_DOWN){
 			if (red){
 				if (redFilter > -1.f)
 					redFilter -= 0.05f;
-				glUseProgram(shader.program);
-				GLint loc = glGetUniformLocation(shader.program, "redFilter");
-				if (loc != -1)
-					glUniform1f(loc, redFilter);
+				viewState.redFilter = redFilter;
 			}
 			if (blue){
 				if (blueFilter > -1.f)
 					blueFilter -= 0.05f;
-				glUseProgram(shader.program);
-				GLint loc = glGetUniformLocation(shader.program, "blueFilter");
-				if (loc != -1)
-					glUniform1f(loc, blueFilter);
+				viewState.blueFilter = blueFilter;
 			}
 			if (green){
 				if (greenFilter > -1.f)
 					greenFilter -= 0.05f;
-				glUseProgram(shader.program);
-				GLint loc = glGetUniformLocation(shader.program, "greenFilter");
-				if (loc != -1)
-					glUniform1f(loc, greenFilter);
+				viewState.greenFilter = greenFilter;
 			}
 		}
 	}
@@ -527,48 +1040,36 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		else if (action == GLFW_RELEASE)
 			blue = false;
 	}
-	glUseProgram(shader.program);
-	GLint loc = glGetUniformLocation(shader.program, "hue");
-	if (loc != -1)
-		glUniform1i(loc, hue);
+	viewState.hue = hue;
+	frameDirty = true;
 }
+// zooming only changes the zoomVer uniform; the texture and geometry for the
+// current image stay resident, so no decode or buffer allocation happens here
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
+	TRACE_SCOPE("scroll_callback");
+	ScopedCpuTimer timer(&perfMonitor, "input");
 	if (!space){
 		if (yoffset < 0){
 			zoom *= 0.9;
-			glUseProgram(shader.program);
-			GLint loc = glGetUniformLocation(shader.program, "zoomVer");
-			if (loc != -1)
-				glUniform1f(loc, zoom);
-			reInit();
-
+			viewState.zoomVer = zoom;
 		}
 		else {
 			zoom *= 1.15;
-			glUseProgram(shader.program);
-			GLint loc = glGetUniformLocation(shader.program, "zoomVer");
-			if (loc != -1)
-				glUniform1f(loc, zoom);
-			reInit();
+			viewState.zoomVer = zoom;
 		}
 	}
 	else{
 		if (yoffset < 0){
 			rotat--;
-			glUseProgram(shader.program);
-			GLint loc = glGetUniformLocation(shader.program, "theta");
-			if (loc != -1)
-				glUniform1f(loc, (M_PI / 90.f) * rotat);
+			viewState.theta = (M_PI / 90.f) * rotat;
 		}
 		else {
 			rotat++;
-			glUseProgram(shader.program);
-			GLint loc = glGetUniformLocation(shader.program, "theta");
-			if (loc != -1)
-				glUniform1f(loc, (M_PI / 90.f) * rotat);
+			viewState.theta = (M_PI / 90.f) * rotat;
 		}
 	}
+	frameDirty = true;
 }
 
 float oriX = 0.f;
@@ -578,6 +1079,8 @@ float r_oriY = 0.f;
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
+	TRACE_SCOPE("mouse_button_callback");
+	ScopedCpuTimer timer(&perfMonitor, "input");
 	if (button == GLFW_MOUSE_BUTTON_LEFT) {
 		if (action == GLFW_PRESS) {
 			mouse_startX = new_x;
@@ -594,6 +1097,8 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 
 static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 {
+	TRACE_SCOPE("cursor_pos_callback");
+	ScopedCpuTimer timer(&perfMonitor, "input");
 	new_x = ((float)xpos) / 1025*2;
 	new_y = ((float)ypos) / 1025*2;
 	if(drag){
@@ -606,23 +1111,185 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 		r_oriX = muda*cos(M_PI / 90.f * rotat) - ora*sin(M_PI / 90.f * rotat);
 		r_oriY = ora*cos(M_PI / 90.f * rotat) + muda*sin(M_PI / 90.f * rotat);
 
-		glUseProgram(shader.program);
-		GLint locX = glGetUniformLocation(shader.program, "displaceX");
-		if (locX != -1)
-			glUniform1f(locX, (r_oriX + oriX));
+		viewState.displaceX = (r_oriX + oriX);
+		viewState.displaceY = (r_oriY + oriY);
+		frameDirty = true;
+	}
+}
 
-		GLint locY = glGetUniformLocation(shader.program, "displaceY");
-		if (locY != -1)
-			glUniform1f(locY, (r_oriY + oriY));
+// records the time since the last frame was shown, and the GPU passes of
+// earlier frames whose timer queries have completed
+void RecordFrameTimes()
+{
+	static double lastSwap = 0.0;
+	double now = glfwGetTime();
+	if (lastSwap > 0.0)
+		perfMonitor.Add(PERF_FRAME, "frame", (now - lastSwap) * 1000.0);
+	lastSwap = now;
+
+	vector<FrameTiming> frames;
+	gpuTimer.Collect(&frames);
+	for (const FrameTiming &frame : frames) {
+		for (const PassTiming &pass : frame.passes)
+			perfMonitor.Add(PERF_GPU, pass.name, pass.ms, pass.megapixels);
+		perfMonitor.Add(PERF_FRAME, "gpu", frame.ms);
 	}
 }
 
+// the window system needs the contents redrawn, e.g. after being uncovered
+void refresh_callback(GLFWwindow* window)
+{
+	frameDirty = true;
+}
+
 
 // ==========================================================================
 // PROGRAM ENTRY POINT
 
 int main(int argc, char *argv[])
 {
+	// startup is timed until the first frame is on screen
+	auto launchTime = chrono::steady_clock::now();
+
+	// cache budgets may be given in megabytes on the command line
+	unsigned decodeThreads = 0;
+	int readAhead = 0;
+	int uploadBandMB = 8;
+	bool onDemand = false;
+	bool batch = false;
+	bool bench = false;
+	bool verify = false;
+	bool benchSizesGiven = false;
+	bool profileLoad = false;
+	string backend;
+	BatchOptions batchOptions;
+	BenchOptions benchOptions;
+	DefaultBenchInputs(&benchOptions);
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--on-demand")
+			onDemand = true;
+		else if (arg == "--hud")
+			hudVisible = true;
+		else if (arg == "--profile-load")
+			profileLoad = true;
+		else if (arg == "--no-shader-cache")
+			shaderCachePath.clear();
+		else if (arg == "--batch") {
+			// every following argument up to the next option is an input file
+			batch = true;
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0)
+				batchOptions.inputs.push_back(argv[++i]);
+		}
+		else if (arg == "--bench" || arg == "--verify") {
+			// images following it replace the bundled ones
+			if (arg == "--bench") bench = true;
+			else verify = true;
+			if (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0)
+				benchOptions.images.clear();
+			while (i + 1 < argc && string(argv[i + 1]).compare(0, 2, "--") != 0)
+				benchOptions.images.push_back(argv[++i]);
+		}
+		else if (i + 1 == argc)
+			break;
+		else if (arg == "--image-cache-mb")
+			imageCache.SetBudget(size_t(atol(argv[++i])) << 20);
+		else if (arg == "--texture-cache-mb")
+			textureCache.SetBudget(size_t(atol(argv[++i])) << 20);
+		else if (arg == "--decode-threads")
+			decodeThreads = unsigned(atoi(argv[++i]));
+		else if (arg == "--readahead")
+			readAhead = max(0, atoi(argv[++i]));
+		else if (arg == "--gpu-budget-mb")
+			resources.SetBudget(size_t(atol(argv[++i])) << 20);
+		else if (arg == "--upload-band-mb")
+			uploadBandMB = max(1, atoi(argv[++i]));
+		else if (arg == "--blur-sigma")
+			blurSigma = min(max(0.5f, float(atof(argv[++i]))), MAX_BLUR_RADIUS / 3.f);
+		else if (arg == "--trace")
+			tracePath = argv[++i];
+		else if (arg == "--shader-cache")
+			shaderCachePath = argv[++i];
+		else if (arg == "--perf-dump")
+			perfDumpPath = argv[++i];
+		else if (arg == "--max-texture")
+			LimitTextureSize(atoi(argv[++i]));
+		else if (arg == "--chain")
+			batchOptions.chain = argv[++i];
+		else if (arg == "--out")
+			batchOptions.outputDir = argv[++i];
+		else if (arg == "--backend")
+			backend = argv[++i];
+		else if (arg == "--bench-sizes") {
+			benchSizesGiven = true;
+			if (!ParseBenchSizes(argv[++i], &benchOptions.sizes)) {
+				cout << "Invalid size list " << argv[i] << ", using the bundled images only" << endl;
+				benchOptions.sizes.clear();
+			}
+		}
+		else if (arg == "--bench-warmup")
+			benchOptions.warmup = max(0, atoi(argv[++i]));
+		else if (arg == "--bench-trials")
+			benchOptions.trials = max(1, atoi(argv[++i]));
+		else if (arg == "--bench-seconds")
+			benchOptions.caseSeconds = atof(argv[++i]);
+		else if (arg == "--bench-out")
+			benchOptions.output = argv[++i];
+		else if (arg == "--cpu-threads")
+			batchOptions.cpuThreads = unsigned(atoi(argv[++i]));
+		else if (arg == "--cpu-tile")
+			batchOptions.tileSize = max(0, atoi(argv[++i]));
+		else if (arg == "--format") {
+			if (!ParseImageFormat(argv[++i], &writeOptions.format))
+				cout << "Unknown image format " << argv[i] << ", writing PNG" << endl;
+		}
+		else if (arg == "--png-level")
+			writeOptions.pngLevel = min(max(atoi(argv[++i]), 0), 9);
+		else if (arg == "--png-filter") {
+			if (!ParsePngFilter(argv[++i], &writeOptions.pngFilter))
+				cout << "Unknown PNG filter " << argv[i] << ", choosing per row" << endl;
+		}
+		else if (arg == "--jpeg-quality")
+			writeOptions.jpegQuality = min(max(atoi(argv[++i]), 1), 100);
+		else if (arg == "--cpu-isa") {
+			CpuIsa isa;
+			if (!ParseIsa(argv[++i], &isa))
+				cout << "Unknown instruction set " << argv[i] << ", using " << IsaName(ActiveIsa()) << endl;
+			else if (!SetIsa(isa))
+				cout << "This processor lacks " << IsaName(isa) << ", using " << IsaName(ActiveIsa()) << endl;
+		}
+	}
+	batchOptions.decodeThreads = decodeThreads;
+	batchOptions.readAhead = readAhead;
+	batchOptions.write = writeOptions;
+	if (!tracePath.empty()) {
+#ifdef ENABLE_TRACE
+		// every mode returns from main, so the trace is written at exit
+		TRACE_THREAD_NAME("main");
+		TraceStart();
+		atexit(WriteTrace);
+#else
+		cout << "Tracing is not compiled in; build with 'make TRACE=1' to use --trace" << endl;
+#endif
+	}
+	perfMonitor.SetLogging(!perfDumpPath.empty());
+	benchOptions.gpu = backend != "cpu";
+	benchOptions.cpu = backend != "gpu";
+	benchOptions.cpuThreads = batchOptions.cpuThreads;
+	benchOptions.blurSigma = blurSigma;
+
+	// comparing every effect on a 16k image takes minutes on the CPU, so
+	// verification stops at 1024 unless sizes were given; --max-texture
+	// makes smaller images take the tiled path
+	if (verify && !benchSizesGiven)
+		benchOptions.sizes = { 256, 1024 };
+
+	// the CPU engine needs no window system or OpenGL context
+	if (batch && backend == "cpu")
+		return RunBatch(batchOptions, nullptr) == 0 ? 0 : 1;
+	if (bench && !benchOptions.gpu)
+		return RunBench(benchOptions, nullptr) ? 0 : 1;
+
 	// initialize the GLFW windowing system
 	if (!glfwInit()) {
 		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
@@ -636,6 +1303,11 @@ int main(int argc, char *argv[])
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	// batch, benchmark and profiling modes only need the context, so their
+	// window is never shown
+	if (batch || bench || verify || profileLoad)
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
 	window = glfwCreateWindow(1025, 1025, "CPSC 453 OpenGL Boilerplate", 0, 0);
 	if (!window) {
 		cout << "Program failed to create GLFW window, TERMINATING" << endl;
@@ -648,37 +1320,206 @@ int main(int argc, char *argv[])
 	glfwSetScrollCallback(window, scroll_callback);
 	glfwSetCursorPosCallback(window, cursor_pos_callback);
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	glfwSetWindowRefreshCallback(window, refresh_callback);
 	glfwMakeContextCurrent(window);
 
 	// query and print out information about our OpenGL environment
 	QueryGLVersion();
+	if (!shaderCachePath.empty())
+		programBinaries.Initialize(shaderCachePath);
 
 	// call function to load and compile shader programs
 	if (!InitializeShaders(&shader)) {
 		cout << "Program could not initialize shaders, TERMINATING" << endl;
 		return -1;
 	}
+	if (!InitializeViewState())
+		cout << "Program failed to intialize view state buffer!" << endl;
+	if (!filterGraph.Initialize())
+		cout << "Program failed to intialize filter graph!" << endl;
+
+	if (batch) {
+		int failures = RunBatch(batchOptions, &filterGraph);
+		filterGraph.Destroy();
+		DestroyViewState();
+		DestroyShaders(&shader);
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return failures == 0 ? 0 : 1;
+	}
+	if (profileLoad) {
+		// loads every bundled image one at a time, as switching to it for
+		// the first time would without the decode pool
+		LoadProfiler profiler;
+		for (int i = 0; i < image_count; i++) {
+			LoadProfile profile;
+			MyTexture loaded;
+			if (!InitializeTexture(&loaded, image_names[i], GL_TEXTURE_RECTANGLE, &profile)) {
+				cout << "Unable to load " << image_names[i] << endl;
+				continue;
+			}
+			profiler.Record(profile);
+			DestroyTexture(&loaded);
+		}
+		profiler.PrintTable();
+		filterGraph.Destroy();
+		DestroyViewState();
+		DestroyShaders(&shader);
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return 0;
+	}
+	if (verify) {
+		bool matched = VerifyBackends(benchOptions, &filterGraph);
+		filterGraph.Destroy();
+		DestroyViewState();
+		DestroyShaders(&shader);
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return matched ? 0 : 1;
+	}
+	if (bench) {
+		bool written = RunBench(benchOptions, &filterGraph);
+		filterGraph.Destroy();
+		DestroyViewState();
+		DestroyShaders(&shader);
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return written ? 0 : 1;
+	}
 
-	if(!InitializeTexture(&texture, "test.jpg", GL_TEXTURE_RECTANGLE))
-		cout << "Program failed to intialize texture!" << endl;
-		
-	// call function to create and fill buffers with geometry data
-	if (!InitializeGeometry(&geometry, texture.height, texture.width))
-		cout << "Program failed to intialize geometry!" << endl;
-
-	// run an event-triggered main loop
+	// start decoding every image in the background; the first one is shown
+	// as soon as it is ready while the window is already responsive
+	decodePool.reset(new DecodePool(decodeThreads));
+	decodePool->SetReadyCallback([] { glfwPostEmptyEvent(); });
+	decodePool->SetReadAhead(readAhead);
+	if (!uploader.Initialize(size_t(uploadBandMB) << 20))
+		cout << "Program failed to create texture upload buffers!" << endl;
+	resources.TrackBuffer(2 * (size_t(uploadBandMB) << 20));
+	resources.SetPressureCallback([] { return textureCache.EvictOldest(displayedKey); });
+	if (!exporter.Initialize() || !tileRenderer.Initialize())
+		cout << "Program failed to intialize image export!" << endl;
+	decodePool->SetPreviewSize(MaxTextureSize());
+	exporter.SetReadyCallback([] { glfwPostEmptyEvent(); });
+	exporter.SetWriteOptions(writeOptions);
+	if (!gpuTimer.Initialize())
+		cout << "GPU timer queries are not available, render passes will not be timed" << endl;
+	filterGraph.SetTimer(&gpuTimer);
+	if (!hud.Initialize())
+		cout << "Program failed to intialize the performance HUD!" << endl;
+	image_name = image_names[0];
+	reInit();
+	for (int i = 1; i < image_count; i++)
+		decodePool->Request(image_names[i]);
+
+	// run an event-triggered main loop, which in on-demand mode only redraws
+	// when something changed and otherwise blocks waiting for events
+	int redraws = 0;
+	double idleTime = 0.0;
+	double loopStart = glfwGetTime();
 	while (!glfwWindowShouldClose(window))
 	{
-		// call function to draw our scene
-		RenderScene(&geometry, &texture, &shader); //render scene with texture
+		ProcessDecodedImages();
+		ProcessUploads();
+		if (tileRenderer.Active() && tileRenderer.Step(false)) {
+			if (tileRenderer.Failed())
+				cout << "Unable to export " << tileExportPath << endl;
+			else {
+				PrintTileStats(tileRenderer.Stats());
+				tileExportReady = true;
+			}
+		}
+
+		// the filtered tiles stay with the renderer until the writer takes them
+		if (tileExportReady && !exporter.Busy()) {
+			tileExportReady = false;
+			if (!exporter.BeginWrite(&tileRenderer.Pixels(), tileRenderer.Width(), tileRenderer.Height(),
+				tileExportPath))
+				cout << "Unable to write " << tileExportPath << endl;
+		}
+		if (exporter.Poll())
+			PrintExportStats(exporter.Stats());
+
+		if (!onDemand || frameDirty) {
+			frameDirty = false;
+			redraws++;
+
+			// while the HUD is up the effects are rendered every frame, so
+			// their passes are timed live rather than once per change
+			double renderStart = glfwGetTime();
+			gpuTimer.BeginFrame();
+			if (hudVisible)
+				filterGraph.Invalidate();
+
+			// call function to draw our scene
+			RenderScene(&geometry, &texture, &shader); //render scene with texture
+
+			if (hudVisible) {
+				gpuTimer.Begin("hud");
+				hud.Draw(perfMonitor.Summary());
+			}
+			gpuTimer.EndFrame();
+			perfMonitor.Add(PERF_CPU, "render", (glfwGetTime() - renderStart) * 1000.0);
+
+			glfwSwapBuffers(window);
+			RecordFrameTimes();
+			if (redraws == 1)
+				PrintStartupTime(chrono::duration<double>(chrono::steady_clock::now() - launchTime).count());
+			if (hudVisible)
+				frameDirty = true;
+		}
 
-		glfwSwapBuffers(window);
+		if (!onDemand) {
+			glfwPollEvents();
+			continue;
+		}
 
-		glfwPollEvents();
+		// uploads and export readbacks advance once per loop, so keep ticking
+		// while one is under way; finished decodes and written exports wake
+		// the loop through glfwPostEmptyEvent
+		double waitStart = glfwGetTime();
+		if (uploader.Active() || !uploadQueue.empty() || exporter.Busy() || tileRenderer.Active()
+			|| tileExportReady)
+			glfwWaitEventsTimeout(0.005);
+		else
+			glfwWaitEvents();
+		idleTime += glfwGetTime() - waitStart;
 	}
 
+	double elapsed = glfwGetTime() - loopStart;
+	cout << "Drew " << redraws << " frames in " << elapsed << " s ("
+		<< (elapsed > 0.0 ? redraws / elapsed : 0.0) << " per second), idle "
+		<< (elapsed > 0.0 ? 100.0 * idleTime / elapsed : 0.0) << "% of the time" << endl;
+
+	PrintCacheStats("Image", imageCache.Stats());
+	PrintCacheStats("Texture", textureCache.Stats());
+	PrintResourceStats(resources.Stats());
+	PrintProgramStats(filterGraph.Programs());
+	PrintProgramBinaryStats(programBinaries.Stats());
+	PrintFilterGraphStats(filterGraph.Stats());
+	PrintRenderTargetStats(filterGraph.PoolStats());
+	if (!perfDumpPath.empty() && perfMonitor.Dump(perfDumpPath))
+		cout << "Wrote " << perfMonitor.Logged() << " performance samples to " << perfDumpPath << endl;
+
 	// clean up allocated resources before exit
+	decodePool.reset();
+	uploadQueue.clear();
+	if (uploader.Active()) {
+		MyTexture abandoned = uploader.Cancel();
+		resources.ReleaseTexture(&abandoned);
+	}
+	uploader.Destroy();
+	exporter.Destroy();
+	tileRenderer.Destroy();
+	hud.Destroy();
+	gpuTimer.Destroy();
+	displayedImage.reset();
+	textureCache.Clear();
+	resources.Destroy();
+	imageCache.Clear();
 	DestroyGeometry(&geometry);
+	DestroyViewState();
+	filterGraph.Destroy();
 	DestroyShaders(&shader);
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -751,9 +1592,22 @@ string LoadSource(const string &filename)
 	return source;
 }
 
+// returns the source with the given lines inserted after its #version line,
+// which must stay the first statement
+string InjectDefines(const string &source, const string &defines)
+{
+	if (defines.empty()) return source;
+	size_t version = source.find("#version");
+	size_t line = version == string::npos ? 0 : source.find('\n', version);
+	if (line == string::npos) return source + "\n" + defines;
+	if (version != string::npos) line++;
+	return source.substr(0, line) + defines + source.substr(line);
+}
+
 // creates and returns a shader object compiled from the given source
 GLuint CompileShader(GLenum shaderType, const string &source)
 {
+	TRACE_SCOPE("CompileShader");
 	// allocate shader object name
 	GLuint shaderObject = glCreateShader(shaderType);
 
@@ -780,10 +1634,13 @@ GLuint CompileShader(GLenum shaderType, const string &source)
 }
 
 // creates and returns a program object linked from vertex and fragment shaders
-GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader)
+GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, bool retrievable)
 {
+	TRACE_SCOPE("LinkProgram");
 	// allocate program object name
 	GLuint programObject = glCreateProgram();
+	if (retrievable)
+		glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
 	// attach provided shader objects to this program
 	if (vertexShader)   glAttachShader(programObject, vertexShader);
@@ -0,0 +1,168 @@
+// ==========================================================================
+// Shared declarations for the OpenGL boilerplate
+//
+// Object structures and OpenGL utility functions used by the main program
+// and by the modules that manage textures and rendering passes.
+//
+// Author:  Sonny Chan, University of Calgary
+// Date:    December 2015
+// ==========================================================================
+#ifndef BOILERPLATE_H
+#define BOILERPLATE_H
+
+#include <cstddef>
+#include <string>
+
+// specify that we want the OpenGL core profile before including GLFW headers
+#define GLFW_INCLUDE_GLCOREARB
+#define GL_GLEXT_PROTOTYPES
+#include <GLFW/glfw3.h>
+
+#include "imagewrite.h"
+
+// --------------------------------------------------------------------------
+// OpenGL utility and support function prototypes
+
+void QueryGLVersion();
+bool CheckGLErrors();
+
+std::string LoadSource(const std::string &filename);
+std::string InjectDefines(const std::string &source, const std::string &defines);
+GLuint CompileShader(GLenum shaderType, const std::string &source);
+// retrievable sets GL_PROGRAM_BINARY_RETRIEVABLE_HINT before linking, so the
+// program can be saved with glGetProgramBinary()
+GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader, bool retrievable = false);
+
+// --------------------------------------------------------------------------
+// OpenGL object structures
+
+struct DecodedImage;
+struct LoadProfile;
+
+struct MyShader
+{
+	// OpenGL names for vertex and fragment shaders, shader program
+	GLuint  vertex;
+	GLuint  fragment;
+	GLuint  program;
+
+	// uniform locations resolved once after linking
+	GLint   textureLocation;
+	GLuint  viewStateIndex;
+
+	// initialize shader and program names to zero (OpenGL reserved value)
+	MyShader() : vertex(0), fragment(0), program(0), textureLocation(-1),
+		viewStateIndex(GL_INVALID_INDEX)
+	{}
+};
+
+// uniform buffer binding point of the ViewState block
+const GLuint VIEW_STATE_BINDING = 0;
+
+// mirrors the std140 ViewState uniform block declared in the shaders; every
+// member is a 4-byte scalar, so they pack without padding
+struct ViewState
+{
+	GLfloat theta;
+	GLfloat displaceX;
+	GLfloat displaceY;
+	GLfloat zoomVer;
+	GLint   greyScale;
+	GLint   filterType;
+	GLint   blurType;
+	GLint   hue;
+	GLfloat redFilter;
+	GLfloat greenFilter;
+	GLfloat blueFilter;
+	GLfloat padding;
+
+	ViewState() : theta(0.f), displaceX(0.f), displaceY(0.f), zoomVer(1.f),
+		greyScale(0), filterType(0), blurType(0), hue(0),
+		redFilter(0.f), greenFilter(0.f), blueFilter(0.f), padding(0.f)
+	{}
+};
+
+struct MyTexture
+{
+	GLuint textureID;
+	GLuint target;
+	GLuint format;
+	int width;
+	int height;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyTexture() : textureID(0), target(0), format(0), width(0), height(0)
+	{}
+};
+
+struct MyGeometry
+{
+	// OpenGL names for array buffer objects, vertex array object
+	GLuint  vertexBuffer;
+	GLuint  textureBuffer;
+	GLuint  colourBuffer;
+	GLuint  vertexArray;
+	GLsizei elementCount;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyGeometry() : vertexBuffer(0), textureBuffer(0), colourBuffer(0), vertexArray(0), elementCount(0)
+	{}
+};
+
+// an offscreen render target with a rectangle texture as its colour buffer
+struct MyFramebuffer
+{
+	GLuint framebuffer;
+	MyTexture texture;
+
+	// initialize object names to zero (OpenGL reserved value)
+	MyFramebuffer() : framebuffer(0)
+	{}
+};
+
+// --------------------------------------------------------------------------
+// Functions to create and destroy the objects above
+
+// defines holds #define lines inserted after the #version line of both
+// shaders, returning false if either failed to compile or link; the program
+// is restored from the program binary cache when it holds one for the
+// resulting sources
+bool InitializeShaders(MyShader *shader, const std::string &vertexFile = "vertex.glsl",
+	const std::string &fragmentFile = "fragment.glsl", const std::string &defines = "");
+void DestroyShaders(MyShader *shader);
+
+bool InitializeQuad(MyGeometry *geometry, float x, float y, float width, float height);
+void DestroyGeometry(MyGeometry *geometry);
+
+// uploads already decoded pixels into a new texture object
+bool InitializeTexture(MyTexture *texture, const DecodedImage &image, GLuint target = GL_TEXTURE_2D);
+
+// loads and uploads an image file; given a profile, it records the time
+// each phase took, waiting for the upload to finish so that it is included
+bool InitializeTexture(MyTexture *texture, const char *filename, GLuint target = GL_TEXTURE_2D,
+	LoadProfile *profile = nullptr);
+
+// deallocate texture-related objects
+void DestroyTexture(MyTexture *texture);
+
+// writes pixel rows in the format of the options, PNG by default; a
+// negative stride writes the rows bottom-up
+bool SaveImage(const char *filename, int width, int height, const unsigned char *data,
+	int numComponents = 3, int stride = 0, const WriteOptions &options = WriteOptions(),
+	WriteStats *stats = nullptr);
+
+// create a render target, or resize an existing one if its size differs;
+// internalFormat is a sized format such as GL_RGBA8 or GL_RGBA16F
+bool InitializeFramebuffer(MyFramebuffer *target, int width, int height, GLenum internalFormat);
+void DestroyFramebuffer(MyFramebuffer *target);
+
+// pixel format used to store an image with the given number of components
+inline GLuint TextureFormat(int components)
+{
+	return components == 3 ? GL_RGB : GL_RGBA;
+}
+
+// approximate video memory held by a texture, assuming RGB is padded to RGBA
+size_t TextureBytes(const MyTexture &texture);
+
+#endif
@@ -0,0 +1,603 @@
+// ==========================================================================
+// CPU reference implementation of every effect in fragment.glsl
+// ==========================================================================
+
+#include "cpufilters.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// The kernels, once per instruction set
+
+#pragma GCC push_options
+#pragma GCC optimize("O2", "no-tree-vectorize")
+namespace scalar {
+#include "cpukernels.inl"
+}
+#pragma GCC pop_options
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_DISPATCH
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#pragma GCC optimize("O3")
+namespace sse41 {
+#include "cpukernels.inl"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#pragma GCC optimize("O3")
+namespace avx2 {
+#include "cpukernels.inl"
+}
+#pragma GCC pop_options
+#endif
+
+namespace
+{
+	struct Kernels
+	{
+		decltype(&scalar::FromBytes) fromBytes;
+		decltype(&scalar::ToBytes) toBytes;
+		decltype(&scalar::Grey) grey;
+		decltype(&scalar::Threshold) threshold;
+		decltype(&scalar::Invert) invert;
+		decltype(&scalar::Offset) offset;
+		decltype(&scalar::Kernel3x3Row) kernel3x3Row;
+		decltype(&scalar::BlurRow) blurRow;
+		decltype(&scalar::BlurColumns) blurColumns;
+	};
+
+#define KERNEL_TABLE(ns) { ns::FromBytes, ns::ToBytes, ns::Grey, ns::Threshold, ns::Invert, \
+	ns::Offset, ns::Kernel3x3Row, ns::BlurRow, ns::BlurColumns }
+
+	const Kernels kernelTables[] = {
+		KERNEL_TABLE(scalar),
+#ifdef CPU_DISPATCH
+		KERNEL_TABLE(sse41),
+		KERNEL_TABLE(avx2),
+#endif
+	};
+
+	CpuIsa SupportedIsa()
+	{
+#ifdef CPU_DISPATCH
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return ISA_AVX2;
+		if (__builtin_cpu_supports("sse4.1")) return ISA_SSE41;
+#endif
+		return ISA_SCALAR;
+	}
+
+	CpuIsa activeIsa = SupportedIsa();
+
+	const Kernels &Active()
+	{
+		return kernelTables[activeIsa];
+	}
+}
+
+CpuIsa ActiveIsa()
+{
+	return activeIsa;
+}
+
+const char *IsaName(CpuIsa isa)
+{
+	switch (isa) {
+	case ISA_AVX2: return "AVX2";
+	case ISA_SSE41: return "SSE4.1";
+	default: return "scalar";
+	}
+}
+
+bool SetIsa(CpuIsa isa)
+{
+	activeIsa = min(isa, SupportedIsa());
+	return activeIsa == isa;
+}
+
+bool ParseIsa(const string &name, CpuIsa *isa)
+{
+	if (name == "scalar") *isa = ISA_SCALAR;
+	else if (name == "sse41") *isa = ISA_SSE41;
+	else if (name == "avx2") *isa = ISA_AVX2;
+	else return false;
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Effects
+
+namespace
+{
+	// splits an image's rows into bands of at least 64 rows, one task each
+	void RunBands(WorkPool *pool, int width, int height, const function<void(size_t, size_t)> &band)
+	{
+		size_t rowsPerBand = 64;
+		if (!pool || height <= int(rowsPerBand)) {
+			band(0, size_t(width) * height);
+			return;
+		}
+		size_t bands = (height + rowsPerBand - 1) / rowsPerBand;
+		pool->Run(bands, [&](size_t index, unsigned) {
+			size_t first = index * rowsPerBand;
+			size_t last = min(first + rowsPerBand, size_t(height));
+			band(first * width, (last - first) * width);
+		});
+	}
+}
+
+void ImageFromBytes(const unsigned char *bytes, int width, int height, int components,
+	CpuImage *image, WorkPool *pool)
+{
+	image->Resize(width, height);
+	const Kernels &k = Active();
+	RunBands(pool, width, height, [&](size_t first, size_t count) {
+		k.fromBytes(bytes + first * components, count, components, image->Plane(0) + first,
+			image->Plane(1) + first, image->Plane(2) + first, image->Plane(3) + first);
+	});
+}
+
+void ImageToBytes(const CpuImage &image, int components, unsigned char *bytes, WorkPool *pool)
+{
+	const Kernels &k = Active();
+	RunBands(pool, image.width, image.height, [&](size_t first, size_t count) {
+		k.toBytes(image.Plane(0) + first, image.Plane(1) + first, image.Plane(2) + first,
+			image.Plane(3) + first, count, components, bytes + first * components);
+	});
+}
+
+namespace
+{
+	void ColourPlanes(float *r, float *g, float *b, float *a, size_t n, int greyScale)
+	{
+		const Kernels &k = Active();
+		switch (greyScale) {
+		case 1: k.grey(r, g, b, a, n, 0.333f, 0.333f, 0.333f, 0.f, 0.f); break;
+		case 2: k.grey(r, g, b, a, n, 0.299f, 0.587f, 0.114f, 0.f, 0.f); break;
+		case 3: k.grey(r, g, b, a, n, 0.213f, 0.715f, 0.072f, 0.f, 0.f); break;
+		case 4: k.grey(r, g, b, a, n, 0.283f, 0.649f, 0.068f, 0.2f, 0.05f); break;
+		case 5: k.threshold(r, g, b, a, n); break;
+		case 6:
+			k.invert(r, n);
+			k.invert(g, n);
+			k.invert(b, n);
+			k.invert(a, n);
+			break;
+		}
+	}
+
+	void HuePlanes(float *r, float *g, float *b, size_t n, const float *hue)
+	{
+		const Kernels &k = Active();
+		k.offset(r, n, hue[0]);
+		k.offset(g, n, hue[1]);
+		k.offset(b, n, hue[2]);
+	}
+}
+
+void CpuColour(CpuImage *image, int greyScale)
+{
+	ColourPlanes(image->Plane(0), image->Plane(1), image->Plane(2), image->Plane(3),
+		image->PlaneSize(), greyScale);
+}
+
+void CpuHue(CpuImage *image, float red, float green, float blue)
+{
+	const float hue[3] = { red, green, blue };
+	HuePlanes(image->Plane(0), image->Plane(1), image->Plane(2), image->PlaneSize(), hue);
+}
+
+void CpuKernel(const CpuImage &source, CpuImage *target, int filterType)
+{
+	const Kernels &k = Active();
+	if (filterType < 0 || filterType > 3) filterType = 0;
+	int width = source.width;
+	int height = source.height;
+	target->Resize(width, height);
+	for (int c = 0; c < 4; c++) {
+		const float *in = source.Plane(c);
+		float *out = target->Plane(c);
+		for (int y = 0; y < height; y++) {
+			const float *up = in + size_t(min(y + 1, height - 1)) * width;
+			const float *mid = in + size_t(y) * width;
+			const float *down = in + size_t(max(y - 1, 0)) * width;
+			k.kernel3x3Row(up, mid, down, out + size_t(y) * width, width, kernelWeights[filterType]);
+		}
+	}
+}
+
+void CpuBlur(const CpuImage &source, CpuImage *target, CpuImage *scratch,
+	const vector<float> &weights)
+{
+	const Kernels &k = Active();
+	int width = source.width;
+	int height = source.height;
+	int radius = int(weights.size()) - 1;
+	scratch->Resize(width, height);
+	target->Resize(width, height);
+
+	vector<const float *> rows(2 * radius + 1);
+	for (int c = 0; c < 4; c++) {
+		const float *in = source.Plane(c);
+		float *across = scratch->Plane(c);
+		float *out = target->Plane(c);
+		for (int y = 0; y < height; y++)
+			k.blurRow(in + size_t(y) * width, across + size_t(y) * width, width, weights.data(), radius);
+		for (int y = 0; y < height; y++) {
+			for (int i = 0; i <= 2 * radius; i++) {
+				int row = min(max(y - radius + i, 0), height - 1);
+				rows[i] = across + size_t(row) * width;
+			}
+			k.blurColumns(rows.data(), out + size_t(y) * width, width, weights.data(), radius);
+		}
+	}
+}
+
+// --------------------------------------------------------------------------
+// Stage chains
+
+namespace
+{
+	typedef vector<unique_ptr<CpuImage>> ImageList;
+
+	// a linked chain with its blur weights worked out once, shared by every
+	// tile it runs on
+	struct ChainPlan
+	{
+		vector<FilterStage> stages;
+		vector<vector<float>> weights;
+		vector<int> readers;	// stages reading each stage's output
+		int halo;				// texels a tile is widened by on each side
+
+		explicit ChainPlan(const vector<FilterStage> &stageList) : stages(stageList), halo(0)
+		{
+			LinkStages(&stages);
+			weights.resize(stages.size());
+			readers.assign(stages.size(), 0);
+			for (size_t i = 0; i < stages.size(); i++) {
+				const FilterStage &stage = stages[i];
+				if (stage.input >= 0) readers[stage.input]++;
+				if (stage.kind == FilterStage::BLUR)
+					weights[i] = BlurWeights(stage.type, stage.sigma);
+			}
+			halo = ChainReach(stages);
+		}
+	};
+
+	unique_ptr<CpuImage> Acquire(ImageList *spare)
+	{
+		if (spare->empty()) return unique_ptr<CpuImage>(new CpuImage());
+		unique_ptr<CpuImage> image = move(spare->back());
+		spare->pop_back();
+		return image;
+	}
+
+	// runs the plan over the source into result, taking intermediate images
+	// from spare and returning them there, so repeated runs on tiles of the
+	// same size allocate nothing
+	void RunPlan(const ChainPlan &plan, const CpuImage &source, CpuImage *result,
+		ImageList *spare)
+	{
+		const vector<FilterStage> &stages = plan.stages;
+
+		// count readers so a stage's image can be reused once it has been read,
+		// as the GPU graph does with its render targets
+		vector<int> readers = plan.readers;
+		ImageList outputs(stages.size());
+
+		for (size_t i = 0; i < stages.size(); i++) {
+			const FilterStage &stage = stages[i];
+			const CpuImage &input = stage.input < 0 ? source : *outputs[stage.input];
+			bool last = i + 1 == stages.size();
+			if (readers[i] == 0 && !last) continue;
+
+			// point effects run in place when this stage is the only reader left
+			bool pointEffect = stage.kind == FilterStage::COLOUR || stage.kind == FilterStage::HUE;
+			if (pointEffect && stage.input >= 0 && readers[stage.input] == 1) {
+				outputs[i] = move(outputs[stage.input]);
+				readers[stage.input] = 0;
+			}
+			else {
+				outputs[i] = Acquire(spare);
+				if (pointEffect) *outputs[i] = input;
+			}
+			CpuImage &output = *outputs[i];
+			switch (stage.kind) {
+			case FilterStage::BLUR: {
+				unique_ptr<CpuImage> scratch = Acquire(spare);
+				CpuBlur(input, &output, scratch.get(), plan.weights[i]);
+				spare->push_back(move(scratch));
+				break;
+			}
+			case FilterStage::KERNEL:
+				CpuKernel(input, &output, stage.type);
+				break;
+			case FilterStage::COLOUR:
+				CpuColour(&output, stage.type);
+				break;
+			case FilterStage::HUE:
+				CpuHue(&output, stage.hue[0], stage.hue[1], stage.hue[2]);
+				break;
+			}
+
+			if (stage.input >= 0 && --readers[stage.input] == 0)
+				spare->push_back(move(outputs[stage.input]));
+		}
+
+		// hand back the result's old storage for the next run
+		swap(*result, *outputs.back());
+		spare->push_back(move(outputs.back()));
+	}
+
+	// copies a width by height block at (x, y) of every plane of source to
+	// (toX, toY) in target
+	void CopyBlock(const CpuImage &source, int x, int y, int width, int height,
+		CpuImage *target, int toX, int toY)
+	{
+		for (int c = 0; c < 4; c++) {
+			const float *from = source.Plane(c) + size_t(y) * source.width + x;
+			float *to = target->Plane(c) + size_t(toY) * target->width + toX;
+			for (int row = 0; row < height; row++)
+				copy(from + size_t(row) * source.width, from + size_t(row) * source.width + width,
+					to + size_t(row) * target->width);
+		}
+	}
+
+	struct TileWorkspace
+	{
+		CpuImage input;
+		CpuImage output;
+		ImageList spare;
+	};
+}
+
+void RunCpuStages(const vector<FilterStage> &stages, const CpuImage &source, CpuImage *result)
+{
+	ChainPlan plan(stages);
+	if (plan.stages.empty()) {
+		*result = source;
+		return;
+	}
+	ImageList spare;
+	RunPlan(plan, source, result, &spare);
+}
+
+void RunCpuStages(const vector<FilterStage> &stages, const CpuImage &source, CpuImage *result,
+	WorkPool *pool, int tileSize)
+{
+	ChainPlan plan(stages);
+	if (plan.stages.empty()) {
+		*result = source;
+		return;
+	}
+	int width = source.width;
+	int height = source.height;
+	int halo = plan.halo;
+	tileSize = max(tileSize, 16);
+	int columns = (width + tileSize - 1) / tileSize;
+	int rows = (height + tileSize - 1) / tileSize;
+	result->Resize(width, height);
+
+	// each tile is cut out with a halo wide enough that its centre comes out
+	// exactly as on the whole image, the halo being clipped at the image
+	// edges where the kernels clamp just as they would on the whole image
+	vector<TileWorkspace> workspaces(pool->Threads());
+	pool->Run(size_t(columns) * rows, [&](size_t index, unsigned worker) {
+		TileWorkspace &workspace = workspaces[worker];
+		int x0 = int(index % columns) * tileSize;
+		int y0 = int(index / columns) * tileSize;
+		int x1 = min(x0 + tileSize, width);
+		int y1 = min(y0 + tileSize, height);
+		int left = max(x0 - halo, 0);
+		int bottom = max(y0 - halo, 0);
+		int right = min(x1 + halo, width);
+		int top = min(y1 + halo, height);
+
+		workspace.input.Resize(right - left, top - bottom);
+		CopyBlock(source, left, bottom, right - left, top - bottom, &workspace.input, 0, 0);
+		RunPlan(plan, workspace.input, &workspace.output, &workspace.spare);
+		CopyBlock(workspace.output, x0 - left, y0 - bottom, x1 - x0, y1 - y0, result, x0, y0);
+	});
+}
+
+// --------------------------------------------------------------------------
+// Row streaming
+
+namespace
+{
+	// the source or one stage of a streamed chain, keeping only the rows of
+	// its output that later stages still have to read
+	struct StreamNode
+	{
+		FilterStage stage;
+		int input;				// node read, -1 for the source
+		int radius;				// rows read above and below the one produced
+		int lead;				// rows this node runs ahead of the output
+		int oldest;				// lowest row, relative to the output, still read
+		bool active;
+		vector<float> weights;
+		CpuImage ring;			// output rows, row y kept in row y % ring.height
+		CpuImage across;		// horizontally blurred input rows of a blur
+		vector<int> acrossRow;	// input row held in each row of across
+
+		StreamNode(const FilterStage &stage, int input)
+			: stage(stage), input(input), radius(0), lead(0), oldest(0), active(false)
+		{}
+	};
+
+	float *RingRow(CpuImage &ring, int channel, int y)
+	{
+		return ring.Plane(channel) + size_t(y % ring.height) * ring.width;
+	}
+
+	// builds the nodes of a chain, the source being node 0, and works out
+	// how far ahead of the output each runs and how many rows it keeps
+	vector<StreamNode> PlanStream(const vector<FilterStage> &stageList, int width)
+	{
+		vector<FilterStage> stages = stageList;
+		LinkStages(&stages);
+		vector<StreamNode> nodes(1, StreamNode(FilterStage(FilterStage::COLOUR), -1));
+		for (const FilterStage &stage : stages) {
+			StreamNode node(stage, stage.input + 1);
+			if (stage.kind == FilterStage::BLUR) {
+				node.weights = BlurWeights(stage.type, stage.sigma);
+				node.radius = int(node.weights.size()) - 1;
+			}
+			else if (stage.kind == FilterStage::KERNEL) {
+				node.radius = 1;
+			}
+			nodes.push_back(node);
+		}
+
+		// a node must have produced every row its readers reach, so it leads
+		// each of them by at least their radius
+		nodes.back().active = true;
+		for (int i = int(nodes.size()) - 1; i > 0; i--) {
+			const StreamNode &node = nodes[i];
+			if (!node.active) continue;
+			StreamNode &input = nodes[node.input];
+			if (!input.active) input.oldest = node.lead - node.radius;
+			input.active = true;
+			input.lead = max(input.lead, node.lead + node.radius);
+			input.oldest = min(input.oldest, node.lead - node.radius);
+		}
+
+		for (StreamNode &node : nodes) {
+			if (!node.active) continue;
+			node.ring.Resize(width, node.lead - node.oldest + 1);
+			if (node.stage.kind == FilterStage::BLUR && node.input >= 0) {
+				node.across.Resize(width, 2 * node.radius + 1);
+				node.acrossRow.assign(2 * node.radius + 1, -1);
+			}
+		}
+		return nodes;
+	}
+
+	size_t StreamBytes(const vector<StreamNode> &nodes)
+	{
+		size_t bytes = 0;
+		for (const StreamNode &node : nodes)
+			bytes += (node.ring.pixels.size() + node.across.pixels.size()) * sizeof(float);
+		return bytes;
+	}
+
+	// computes row y of a node from the rows of its input
+	void ProduceRow(vector<StreamNode> &nodes, size_t index, int y, int height,
+		const unsigned char *bytes, int components)
+	{
+		const Kernels &k = Active();
+		StreamNode &node = nodes[index];
+		int width = node.ring.width;
+		float *out[4];
+		for (int c = 0; c < 4; c++)
+			out[c] = RingRow(node.ring, c, y);
+
+		if (node.input < 0) {
+			k.fromBytes(bytes + size_t(y) * width * components, width, components,
+				out[0], out[1], out[2], out[3]);
+			return;
+		}
+
+		StreamNode &input = nodes[node.input];
+		switch (node.stage.kind) {
+		case FilterStage::COLOUR:
+		case FilterStage::HUE:
+			for (int c = 0; c < 4; c++) {
+				const float *in = RingRow(input.ring, c, y);
+				copy(in, in + width, out[c]);
+			}
+			if (node.stage.kind == FilterStage::COLOUR)
+				ColourPlanes(out[0], out[1], out[2], out[3], width, node.stage.type);
+			else
+				HuePlanes(out[0], out[1], out[2], width, node.stage.hue);
+			break;
+		case FilterStage::KERNEL: {
+			int type = node.stage.type < 0 || node.stage.type > 3 ? 0 : node.stage.type;
+			for (int c = 0; c < 4; c++) {
+				k.kernel3x3Row(RingRow(input.ring, c, min(y + 1, height - 1)), RingRow(input.ring, c, y),
+					RingRow(input.ring, c, max(y - 1, 0)), out[c], width, kernelWeights[type]);
+			}
+			break;
+		}
+		case FilterStage::BLUR: {
+			// rows blurred across are kept for the 2 * radius + 1 rows using them
+			int radius = node.radius;
+			int span = 2 * radius + 1;
+			const float *rows[2 * MAX_BLUR_RADIUS + 1];
+			for (int c = 0; c < 4; c++) {
+				for (int i = 0; i < span; i++) {
+					int row = min(max(y - radius + i, 0), height - 1);
+					float *across = node.across.Plane(c) + size_t(row % span) * width;
+					if (node.acrossRow[row % span] != row)
+						k.blurRow(RingRow(input.ring, c, row), across, width, node.weights.data(), radius);
+					rows[i] = across;
+				}
+				k.blurColumns(rows, out[c], width, node.weights.data(), radius);
+			}
+			for (int i = 0; i < span; i++) {
+				int row = min(max(y - radius + i, 0), height - 1);
+				node.acrossRow[row % span] = row;
+			}
+			break;
+		}
+		}
+	}
+
+	// streams output rows first to last - 1 through the nodes, starting far
+	// enough back that every row they read has been produced
+	void StreamRows(vector<StreamNode> &nodes, int first, int last, int height,
+		const unsigned char *bytes, int components, unsigned char *output, int outputComponents)
+	{
+		const Kernels &k = Active();
+		StreamNode &result = nodes.back();
+		int width = result.ring.width;
+		int lead = nodes[0].lead;
+		for (int y = first - 2 * lead; y < last; y++) {
+			for (size_t i = 0; i < nodes.size(); i++) {
+				const StreamNode &node = nodes[i];
+				int row = y + node.lead;
+				if (!node.active || row < max(first - node.lead, 0) || row >= min(last + node.lead, height))
+					continue;
+				ProduceRow(nodes, i, row, height, bytes, components);
+			}
+			if (y >= first) {
+				k.toBytes(RingRow(result.ring, 0, y), RingRow(result.ring, 1, y), RingRow(result.ring, 2, y),
+					RingRow(result.ring, 3, y), width, outputComponents,
+					output + size_t(y) * width * outputComponents);
+			}
+		}
+	}
+}
+
+size_t StreamCpuStages(const vector<FilterStage> &stages, const unsigned char *bytes, int width,
+	int height, int components, unsigned char *output, int outputComponents, WorkPool *pool)
+{
+	vector<StreamNode> plan = PlanStream(stages, width);
+	if (!pool || height < 64) {
+		StreamRows(plan, 0, height, height, bytes, components, output, outputComponents);
+		return StreamBytes(plan);
+	}
+
+	// bands of rows stream independently, each starting with the rows above
+	// it that its neighbourhoods reach, so bands are kept a few times taller
+	// than that overlap
+	int bandHeight = max(max(4 * plan[0].lead, 64),
+		int((height + 4 * pool->Threads() - 1) / (4 * pool->Threads())));
+	int bands = (height + bandHeight - 1) / bandHeight;
+	pool->Run(size_t(bands), [&](size_t index, unsigned) {
+		vector<StreamNode> nodes = plan;
+		int first = int(index) * bandHeight;
+		StreamRows(nodes, first, min(first + bandHeight, height), height, bytes, components, output,
+			outputComponents);
+	});
+	return StreamBytes(plan) * min(unsigned(bands), pool->Threads());
+}
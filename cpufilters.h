@@ -0,0 +1,108 @@
+// ==========================================================================
+// CPU reference implementation of every effect in fragment.glsl
+//
+// Images are held as four planes of floats (red, green, blue, alpha), so the
+// same values the GPU keeps in its half float targets survive between
+// stages, and each effect is a plain loop over a plane that the compiler
+// vectorizes. The kernels are compiled three times, for SSE4.1, for AVX2 and
+// as a scalar fallback, and the widest set the processor supports is picked
+// at run time. Pixel rows keep the bottom-up order DecodeImage() leaves
+// them in with FlipRows(), so "up" in the 3x3 kernels is the next row in
+// memory as on the GPU.
+// ==========================================================================
+#ifndef CPUFILTERS_H
+#define CPUFILTERS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "filterkernels.h"
+#include "workpool.h"
+
+struct CpuImage
+{
+	int width;
+	int height;
+	std::vector<float> pixels;	// red, green, blue and alpha planes in turn
+
+	CpuImage() : width(0), height(0)
+	{}
+
+	void Resize(int w, int h)
+	{
+		width = w;
+		height = h;
+		pixels.resize(size_t(w) * h * 4);
+	}
+
+	size_t PlaneSize() const { return size_t(width) * height; }
+	float *Plane(int channel) { return pixels.data() + channel * PlaneSize(); }
+	const float *Plane(int channel) const { return pixels.data() + channel * PlaneSize(); }
+};
+
+enum CpuIsa { ISA_SCALAR, ISA_SSE41, ISA_AVX2 };
+
+// the instruction set in use, by default the widest the processor supports
+CpuIsa ActiveIsa();
+const char *IsaName(CpuIsa isa);
+
+// selects a narrower instruction set, e.g. to compare against the scalar
+// kernels; a set the processor lacks falls back to the widest it has, and
+// false is returned
+bool SetIsa(CpuIsa isa);
+
+// parses "scalar", "sse41" or "avx2"
+bool ParseIsa(const std::string &name, CpuIsa *isa);
+
+// converts interleaved 8-bit pixels with 1 to 4 components to planes;
+// missing colour channels repeat grey and missing alpha is one, as when
+// sampling the texture; bands of rows are converted in parallel if a pool
+// is given
+void ImageFromBytes(const unsigned char *bytes, int width, int height, int components,
+	CpuImage *image, WorkPool *pool = nullptr);
+
+// converts planes to interleaved 8-bit pixels with 3 or 4 components,
+// clamping to [0, 1] and rounding as the GPU does when it writes unorm8
+void ImageToBytes(const CpuImage &image, int components, unsigned char *bytes,
+	WorkPool *pool = nullptr);
+
+// point effects applied in place: greyScale 1 to 6 as in fragment.glsl, and
+// the hue offsets added to red, green and blue
+void CpuColour(CpuImage *image, int greyScale);
+void CpuHue(CpuImage *image, float red, float green, float blue);
+
+// 3x3 filterType 1 to 3 as in fragment.glsl, taking the absolute value
+void CpuKernel(const CpuImage &source, CpuImage *target, int filterType);
+
+// separable blur with weights from BlurWeights(); scratch holds the
+// horizontal pass
+void CpuBlur(const CpuImage &source, CpuImage *target, CpuImage *scratch,
+	const std::vector<float> &weights);
+
+// runs the stages over the source as the filter graph does, leaving the
+// output of the last stage, or a copy of the source if there are none, in
+// result; stage inputs are linked as by LinkStages()
+void RunCpuStages(const std::vector<FilterStage> &stages, const CpuImage &source,
+	CpuImage *result);
+
+// the same on the pool's threads, one square tile of tileSize texels at a
+// time: each tile is cut out with a halo as wide as the chain's blurs and
+// 3x3 kernels reach and the whole chain runs on it before the next, so the
+// intermediate images stay in cache; the result is identical to the above
+const int CPU_TILE_SIZE = 128;
+void RunCpuStages(const std::vector<FilterStage> &stages, const CpuImage &source,
+	CpuImage *result, WorkPool *pool, int tileSize = CPU_TILE_SIZE);
+
+// runs the stages from interleaved 8-bit pixels with 1 to 4 components to
+// 8-bit pixels with 3 or 4, a row at a time: each stage keeps only the rows
+// of its output that later stages still read, so the memory used grows with
+// the width of the image and the height of the chain's neighbourhoods rather
+// than its area; given a pool, bands of rows stream in parallel. Returns the
+// bytes of row buffers in use, and the output is identical to that of
+// RunCpuStages()
+size_t StreamCpuStages(const std::vector<FilterStage> &stages, const unsigned char *bytes,
+	int width, int height, int components, unsigned char *output, int outputComponents,
+	WorkPool *pool = nullptr);
+
+#endif
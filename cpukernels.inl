@@ -0,0 +1,185 @@
+// ==========================================================================
+// Loops of the CPU filter engine
+//
+// Included by cpufilters.cpp once per instruction set, inside a namespace
+// and a target pragma, so the same source becomes the scalar, SSE4.1 and
+// AVX2 kernels. Each loop works on whole rows or planes with no aliasing,
+// which is what lets the compiler vectorize it; borders are handled by
+// separate scalar code. Every output sums its terms in the same order in all
+// three versions, so they produce identical results.
+// ==========================================================================
+
+static inline float Clamped(const float *row, int x, int width)
+{
+	return row[x < 0 ? 0 : (x >= width ? width - 1 : x)];
+}
+
+void FromBytes(const unsigned char *__restrict bytes, size_t count, int components,
+	float *__restrict r, float *__restrict g, float *__restrict b, float *__restrict a)
+{
+	const float scale = 1.f / 255.f;
+	switch (components) {
+	case 1:
+		for (size_t i = 0; i < count; i++) {
+			float l = bytes[i] * scale;
+			r[i] = l; g[i] = l; b[i] = l; a[i] = 1.f;
+		}
+		break;
+	case 2:
+		for (size_t i = 0; i < count; i++) {
+			float l = bytes[2 * i] * scale;
+			r[i] = l; g[i] = l; b[i] = l; a[i] = bytes[2 * i + 1] * scale;
+		}
+		break;
+	case 3:
+		for (size_t i = 0; i < count; i++) {
+			r[i] = bytes[3 * i] * scale;
+			g[i] = bytes[3 * i + 1] * scale;
+			b[i] = bytes[3 * i + 2] * scale;
+			a[i] = 1.f;
+		}
+		break;
+	default:
+		for (size_t i = 0; i < count; i++) {
+			r[i] = bytes[4 * i] * scale;
+			g[i] = bytes[4 * i + 1] * scale;
+			b[i] = bytes[4 * i + 2] * scale;
+			a[i] = bytes[4 * i + 3] * scale;
+		}
+		break;
+	}
+}
+
+static inline unsigned char ToUnorm(float v)
+{
+	v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+	return (unsigned char)(int)(v * 255.f + 0.5f);
+}
+
+void ToBytes(const float *__restrict r, const float *__restrict g, const float *__restrict b,
+	const float *__restrict a, size_t count, int components, unsigned char *__restrict bytes)
+{
+	if (components == 3) {
+		for (size_t i = 0; i < count; i++) {
+			bytes[3 * i] = ToUnorm(r[i]);
+			bytes[3 * i + 1] = ToUnorm(g[i]);
+			bytes[3 * i + 2] = ToUnorm(b[i]);
+		}
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		bytes[4 * i] = ToUnorm(r[i]);
+		bytes[4 * i + 1] = ToUnorm(g[i]);
+		bytes[4 * i + 2] = ToUnorm(b[i]);
+		bytes[4 * i + 3] = ToUnorm(a[i]);
+	}
+}
+
+// l = dot(ratios, rgb), written as (l + addRed, l + addGreen, l, 0); covers
+// the three greyscale modes and sepia
+void Grey(float *__restrict r, float *__restrict g, float *__restrict b, float *__restrict a,
+	size_t count, float wr, float wg, float wb, float addRed, float addGreen)
+{
+	for (size_t i = 0; i < count; i++) {
+		float l = wr * r[i] + wg * g[i] + wb * b[i];
+		r[i] = l + addRed;
+		g[i] = l + addGreen;
+		b[i] = l;
+		a[i] = 0.f;
+	}
+}
+
+// the grunge black and white mode
+void Threshold(float *__restrict r, float *__restrict g, float *__restrict b,
+	float *__restrict a, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		float l = 0.283f * r[i] + 0.649f * g[i] + 0.068f * b[i];
+		float v = l < 0.5f ? 0.f : 1.f;
+		r[i] = v;
+		g[i] = v;
+		b[i] = v;
+		a[i] = 0.f;
+	}
+}
+
+// 1 - value, used for the negative mode on all four planes
+void Invert(float *__restrict p, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		p[i] = 1.f - p[i];
+}
+
+void Offset(float *__restrict p, size_t count, float amount)
+{
+	for (size_t i = 0; i < count; i++)
+		p[i] += amount;
+}
+
+// one output row of a 3x3 kernel given the rows above (+y), at and below
+void Kernel3x3Row(const float *__restrict up, const float *__restrict mid,
+	const float *__restrict down, float *__restrict out, int width, const float *w)
+{
+	const float w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3], w4 = w[4];
+	const float w5 = w[5], w6 = w[6], w7 = w[7], w8 = w[8];
+	for (int x = 1; x < width - 1; x++) {
+		float v = w0 * up[x - 1] + w1 * up[x] + w2 * up[x + 1]
+			+ w3 * mid[x - 1] + w4 * mid[x] + w5 * mid[x + 1]
+			+ w6 * down[x - 1] + w7 * down[x] + w8 * down[x + 1];
+		out[x] = v < 0.f ? -v : v;
+	}
+
+	// first and last columns clamp to the edge like the texture sampler
+	int edges[2] = { 0, width - 1 };
+	for (int e = 0; e < (width > 1 ? 2 : 1); e++) {
+		int x = edges[e];
+		float v = w0 * Clamped(up, x - 1, width) + w1 * up[x] + w2 * Clamped(up, x + 1, width)
+			+ w3 * Clamped(mid, x - 1, width) + w4 * mid[x] + w5 * Clamped(mid, x + 1, width)
+			+ w6 * Clamped(down, x - 1, width) + w7 * down[x] + w8 * Clamped(down, x + 1, width);
+		out[x] = v < 0.f ? -v : v;
+	}
+}
+
+// horizontal blur of one row; weights[0] is the centre
+void BlurRow(const float *__restrict in, float *__restrict out, int width,
+	const float *weights, int radius)
+{
+	int begin = radius < width ? radius : width;
+	int end = width - radius > begin ? width - radius : begin;
+
+	for (int x = begin; x < end; x++)
+		out[x] = weights[0] * in[x];
+	for (int k = 1; k <= radius; k++) {
+		const float w = weights[k];
+		for (int x = begin; x < end; x++)
+			out[x] += w * (in[x - k] + in[x + k]);
+	}
+
+	// texels near either end repeat the edge texel, accumulated in the same
+	// order as the interior
+	for (int x = 0; x < width; x++) {
+		if (x == begin) x = end;
+		if (x >= width) break;
+		float v = weights[0] * in[x];
+		for (int k = 1; k <= radius; k++)
+			v += weights[k] * (Clamped(in, x - k, width) + Clamped(in, x + k, width));
+		out[x] = v;
+	}
+}
+
+// vertical blur of one row from the 2 * radius + 1 rows centred on it,
+// already clamped to the image by the caller
+void BlurColumns(const float *const *rows, float *__restrict out, int width,
+	const float *weights, int radius)
+{
+	const float *__restrict centre = rows[radius];
+	for (int x = 0; x < width; x++)
+		out[x] = weights[0] * centre[x];
+	for (int k = 1; k <= radius; k++) {
+		const float w = weights[k];
+		const float *__restrict below = rows[radius - k];
+		const float *__restrict above = rows[radius + k];
+		for (int x = 0; x < width; x++)
+			out[x] += w * (below[x] + above[x]);
+	}
+}
@@ -0,0 +1,176 @@
+// ==========================================================================
+// Background image decoding
+// ==========================================================================
+
+#include "decodepool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "trace.h"
+
+using namespace std;
+
+DecodePool::DecodePool(unsigned threads) : previewSize(0), stopping(false), readAhead(0)
+{
+	if (threads == 0) {
+		unsigned hardware = thread::hardware_concurrency();
+		threads = hardware > 1 ? hardware - 1 : 1;
+	}
+	for (unsigned i = 0; i < threads; i++)
+		workers.push_back(thread(&DecodePool::WorkerLoop, this));
+}
+
+DecodePool::~DecodePool()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		stopping = true;
+		queue.clear();
+	}
+	wake.notify_all();
+	readAheadWake.notify_all();
+	for (thread &worker : workers)
+		worker.join();
+	if (readAheadThread.joinable()) readAheadThread.join();
+}
+
+void DecodePool::Request(const string &path, bool urgent)
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		if (pending.count(path)) {
+			// promote a queued request if it became urgent
+			auto it = find(queue.begin(), queue.end(), path);
+			if (urgent && it != queue.end()) {
+				queue.erase(it);
+				queue.push_front(path);
+			}
+			return;
+		}
+		pending.insert(path);
+		if (urgent) queue.push_front(path);
+		else queue.push_back(path);
+	}
+	wake.notify_one();
+	readAheadWake.notify_one();
+}
+
+bool DecodePool::Poll(DecodeResult *result)
+{
+	lock_guard<mutex> lock(queueMutex);
+	if (finished.empty()) return false;
+	*result = finished.front();
+	finished.pop_front();
+	pending.erase(result->path);
+	return true;
+}
+
+bool DecodePool::Busy()
+{
+	lock_guard<mutex> lock(queueMutex);
+	return !pending.empty();
+}
+
+void DecodePool::SetReadyCallback(function<void()> callback)
+{
+	lock_guard<mutex> lock(queueMutex);
+	onReady = callback;
+}
+
+void DecodePool::SetPreviewSize(int size)
+{
+	lock_guard<mutex> lock(queueMutex);
+	previewSize = size;
+}
+
+void DecodePool::SetReadAhead(int files)
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		readAhead = max(files, 0);
+		if (readAhead > 0 && !readAheadThread.joinable())
+			readAheadThread = thread(&DecodePool::ReadAheadLoop, this);
+	}
+	readAheadWake.notify_one();
+}
+
+// the first queued file within the read-ahead distance not yet mapped;
+// called with the queue locked
+bool DecodePool::NextToMap(string *path) const
+{
+	size_t count = min(queue.size(), size_t(readAhead));
+	for (size_t i = 0; i < count; i++) {
+		if (!mapped.count(queue[i])) {
+			*path = queue[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+void DecodePool::ReadAheadLoop()
+{
+	TRACE_THREAD_NAME("read ahead");
+	for (;;) {
+		string path;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			readAheadWake.wait(lock, [&] { return stopping || NextToMap(&path); });
+			if (stopping) return;
+		}
+
+		shared_ptr<MappedFile> file = make_shared<MappedFile>();
+		if (!file->Open(path, true)) file.reset();
+
+		// a worker may have started on the file while it was being mapped
+		lock_guard<mutex> lock(queueMutex);
+		if (find(queue.begin(), queue.end(), path) != queue.end())
+			mapped[path] = file;
+	}
+}
+
+void DecodePool::WorkerLoop()
+{
+	TRACE_THREAD_NAME("decode");
+	for (;;) {
+		string path;
+		int maxSize;
+		DecodeResult result;
+		shared_ptr<MappedFile> file;
+		{
+			unique_lock<mutex> lock(queueMutex);
+			wake.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (stopping) return;
+			path = queue.front();
+			queue.pop_front();
+			maxSize = previewSize;
+			auto it = mapped.find(path);
+			if (it != mapped.end()) {
+				file = it->second;
+				result.mappedAhead = file != nullptr;
+				mapped.erase(it);
+			}
+		}
+		readAheadWake.notify_one();
+
+		result.path = path;
+		result.key = ImageKey(path.c_str());
+		auto start = chrono::steady_clock::now();
+		if (file) result.image = DecodeImage(file->Data(), file->Size());
+		else result.image = DecodeImage(path.c_str());
+		file.reset();
+		if (result.image && maxSize > 0
+			&& (result.image->width > maxSize || result.image->height > maxSize))
+			result.image->preview = ReduceImage(*result.image, maxSize);
+		result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		function<void()> callback;
+		{
+			lock_guard<mutex> lock(queueMutex);
+			finished.push_back(result);
+			callback = onReady;
+		}
+		if (callback) callback();
+	}
+}
@@ -0,0 +1,91 @@
+// ==========================================================================
+// Background image decoding
+//
+// A small pool of worker threads decodes image files with stb_image while the
+// render thread keeps drawing. Finished images are collected by the render
+// thread with Poll(), which is where any OpenGL upload has to happen. Files
+// are decoded from memory mappings; an optional read-ahead thread maps the
+// next few queued files early, so their pages are already being read from
+// disk while the workers decode the files before them.
+// ==========================================================================
+#ifndef DECODEPOOL_H
+#define DECODEPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "imagecache.h"
+#include "mappedfile.h"
+
+struct DecodeResult
+{
+	std::string path;
+	std::string key;
+	std::shared_ptr<DecodedImage> image;	// null if the file failed to decode
+	double seconds;
+	bool mappedAhead;						// mapped by the read-ahead thread
+
+	DecodeResult() : seconds(0.0), mappedAhead(false)
+	{}
+};
+
+class DecodePool
+{
+public:
+	// zero threads picks one less than the number of hardware threads
+	explicit DecodePool(unsigned threads = 0);
+	~DecodePool();
+
+	// queues a file for decoding unless it is already queued or in flight;
+	// urgent requests jump to the front of the queue
+	void Request(const std::string &path, bool urgent = false);
+
+	// retrieves one finished decode, returning false if none are ready
+	bool Poll(DecodeResult *result);
+
+	// true while any request is queued, decoding, or waiting to be polled
+	bool Busy();
+
+	// called from a worker thread whenever a result becomes ready
+	void SetReadyCallback(std::function<void()> callback);
+
+	// images wider or taller than this get a preview that fits made by the
+	// worker decoding them; zero, the default, makes none
+	void SetPreviewSize(int size);
+
+	// maps up to this many of the files next in the queue ahead of the
+	// workers on a thread of its own; zero, the default, maps each file only
+	// when a worker starts decoding it
+	void SetReadAhead(int files);
+
+private:
+	void WorkerLoop();
+	void ReadAheadLoop();
+	bool NextToMap(std::string *path) const;
+
+	std::vector<std::thread> workers;
+	std::mutex queueMutex;
+	std::condition_variable wake;
+	std::deque<std::string> queue;
+	std::set<std::string> pending;
+	std::deque<DecodeResult> finished;
+	std::function<void()> onReady;
+	int previewSize;
+	bool stopping;
+
+	// mappings made ahead of the workers, null where mapping failed
+	std::thread readAheadThread;
+	std::condition_variable readAheadWake;
+	std::map<std::string, std::shared_ptr<MappedFile>> mapped;
+	int readAhead;
+};
+
+#endif
@@ -0,0 +1,240 @@
+// ==========================================================================
+// Exporting the filtered image without stalling the viewer
+// ==========================================================================
+
+#include "exporter.h"
+
+#include <iostream>
+
+#include "trace.h"
+
+using namespace std;
+
+// rows read back as tightly packed RGB, as the batch mode writes them
+const int EXPORT_COMPONENTS = 3;
+
+ImageExporter::ImageExporter()
+	: buffer(0), fence(0), state(IDLE), pixels(nullptr), stride(0), pending(false),
+	written(false), stopping(false)
+{}
+
+ImageExporter::~ImageExporter()
+{
+	{
+		lock_guard<mutex> lock(writerMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	if (writer.joinable()) writer.join();
+}
+
+bool ImageExporter::Initialize()
+{
+	// fragment.glsl without any effect defined draws the image unchanged
+	if (!InitializeShaders(&shader, "passvertex.glsl", "fragment.glsl"))
+		return false;
+	if (!pool) pool.reset(new WorkPool());
+	if (!writer.joinable())
+		writer = thread(&ImageExporter::WriterLoop, this);
+	return true;
+}
+
+void ImageExporter::Destroy()
+{
+	// the writer may still be reading the mapped buffer
+	{
+		unique_lock<mutex> lock(writerMutex);
+		wake.wait(lock, [this] { return !pending; });
+	}
+	Release();
+	state = IDLE;
+	DestroyGeometry(&quad);
+	DestroyShaders(&shader);
+	shader = MyShader();
+}
+
+void ImageExporter::SetReadyCallback(function<void()> callback)
+{
+	lock_guard<mutex> lock(writerMutex);
+	onReady = callback;
+}
+
+void ImageExporter::SetWriteOptions(const WriteOptions &options)
+{
+	lock_guard<mutex> lock(writerMutex);
+	writeOptions = options;
+}
+
+// deletes the render target and pixel buffer, which only live for one
+// export so a large image does not hold on to video memory afterwards
+void ImageExporter::Release()
+{
+	if (fence) {
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	if (buffer) {
+		if (pixels) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+	pixels = nullptr;
+	vector<unsigned char>().swap(rows);
+	DestroyFramebuffer(&target);
+}
+
+bool ImageExporter::Begin(const MyTexture &image, const string &path)
+{
+	if (state != IDLE || image.textureID == 0 || shader.program == 0) return false;
+	start = chrono::steady_clock::now();
+	stats = ExportStats();
+	stats.path = path;
+	stats.width = image.width;
+	stats.height = image.height;
+
+	// a quad with y flipped puts the top image row in the first row of the
+	// target, so the pixels read back are in file order
+	if (!InitializeFramebuffer(&target, image.width, image.height, GL_RGBA8)
+		|| !InitializeQuad(&quad, 1.f, -1.f, float(image.width), float(image.height))) {
+		Release();
+		return false;
+	}
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, image.width, image.height);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+	glUseProgram(shader.program);
+	glBindVertexArray(quad.vertexArray);
+	glBindTexture(image.target, image.textureID);
+	glDrawArrays(GL_TRIANGLES, 0, quad.elementCount);
+	glBindTexture(image.target, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	// queue the copy into the pixel buffer; nothing waits for it here
+	size_t bytes = size_t(image.width) * image.height * EXPORT_COMPONENTS;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, image.width, image.height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	if (CheckGLErrors()) {
+		Release();
+		return false;
+	}
+	state = READING;
+	stats.issueSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+bool ImageExporter::BeginWrite(vector<unsigned char> *source, int width, int height,
+	const string &path)
+{
+	if (state != IDLE || !writer.joinable()) return false;
+	start = chrono::steady_clock::now();
+	stats = ExportStats();
+	stats.path = path;
+	stats.width = width;
+	stats.height = height;
+	{
+		lock_guard<mutex> lock(writerMutex);
+		rows.swap(*source);
+		pixels = rows.data() + size_t(width) * EXPORT_COMPONENTS * (height - 1);
+		stride = -width * EXPORT_COMPONENTS;
+		pending = true;
+		written = false;
+	}
+	wake.notify_all();
+	state = WRITING;
+	return true;
+}
+
+bool ImageExporter::Poll()
+{
+	if (state == READING) {
+		stats.frames++;
+		if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(fence);
+		fence = 0;
+		stats.readbackSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		// the target is no longer needed once its pixels are in the buffer
+		DestroyFramebuffer(&target);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+		void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+			size_t(stats.width) * stats.height * EXPORT_COMPONENTS, GL_MAP_READ_BIT);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!mapped) {
+			cout << "Unable to map the pixels of " << stats.path << endl;
+			Release();
+			state = IDLE;
+			return false;
+		}
+		{
+			lock_guard<mutex> lock(writerMutex);
+			pixels = static_cast<unsigned char *>(mapped);
+			stride = 0;
+			pending = true;
+			written = false;
+		}
+		wake.notify_all();
+		state = WRITING;
+		return false;
+	}
+
+	if (state == WRITING) {
+		{
+			lock_guard<mutex> lock(writerMutex);
+			if (!written) return false;
+		}
+		Release();
+		state = IDLE;
+		return true;
+	}
+	return false;
+}
+
+void ImageExporter::WriterLoop()
+{
+	TRACE_THREAD_NAME("export writer");
+	for (;;) {
+		{
+			unique_lock<mutex> lock(writerMutex);
+			wake.wait(lock, [this] { return stopping || pending; });
+			if (stopping && !pending) return;
+		}
+
+		WriteOptions options;
+		{
+			lock_guard<mutex> lock(writerMutex);
+			options = writeOptions;
+		}
+		options.pool = pool.get();
+		WriteStats file;
+		SaveImage(stats.path.c_str(), stats.width, stats.height, pixels, EXPORT_COMPONENTS, stride,
+			options, &file);
+
+		function<void()> callback;
+		{
+			lock_guard<mutex> lock(writerMutex);
+			stats.file = file;
+			pending = false;
+			written = true;
+			callback = onReady;
+		}
+		wake.notify_all();
+		if (callback) callback();
+	}
+}
@@ -0,0 +1,115 @@
+// ==========================================================================
+// Exporting the filtered image without stalling the viewer
+//
+// The filtered image is drawn at its own resolution, not the window's, into
+// an 8-bit render target, flipped so its rows come out top-down, and read
+// back into a pixel pack buffer. glReadPixels into a buffer returns at once;
+// a fence tells a later frame when the copy has finished. The buffer is then
+// mapped and handed to a writer thread, which encodes the file while the
+// render thread keeps drawing, and is unmapped once the file is written.
+// Images too large for one texture are filtered by a TileRenderer instead,
+// whose rows are handed to the same writer thread. The writer encodes PNG
+// and JPEG files in bands on its own work pool.
+// ==========================================================================
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "boilerplate.h"
+#include "imagewrite.h"
+#include "workpool.h"
+
+struct ExportStats
+{
+	std::string path;
+	int width;
+	int height;
+	int frames;				// Poll() calls from Begin() until the pixels arrived
+	double issueSeconds;	// render thread time spent in Begin()
+	double readbackSeconds;	// from Begin() until the pixels arrived
+	WriteStats file;		// encoding and writing on the writer thread
+
+	ExportStats() : width(0), height(0), frames(0), issueSeconds(0.0),
+		readbackSeconds(0.0)
+	{}
+};
+
+class ImageExporter
+{
+public:
+	ImageExporter();
+	~ImageExporter();
+
+	// compiles the program drawing the image; requires a current context
+	bool Initialize();
+
+	// waits for an export in progress and deletes the OpenGL objects
+	void Destroy();
+
+	// starts exporting the image to a file at path, returning false if the
+	// previous export has not finished yet
+	bool Begin(const MyTexture &image, const std::string &path);
+
+	// starts writing RGB rows already in memory, bottom row first, such as
+	// those of a TileRenderer; the rows are taken over from the vector
+	bool BeginWrite(std::vector<unsigned char> *rows, int width, int height,
+		const std::string &path);
+
+	// called once per frame: hands the pixels to the writer thread once they
+	// have arrived and cleans up after it, returning true when an export has
+	// just completed
+	bool Poll();
+
+	// true from Begin() until Poll() has seen the file written
+	bool Busy() const { return state != IDLE; }
+
+	// called from the writer thread when a file has been written
+	void SetReadyCallback(std::function<void()> callback);
+
+	// format and compression of the files written
+	void SetWriteOptions(const WriteOptions &options);
+
+	// figures of the last completed export
+	const ExportStats &Stats() const { return stats; }
+
+private:
+	enum State { IDLE, READING, WRITING };
+
+	void WriterLoop();
+	void Release();
+
+	MyShader shader;
+	MyGeometry quad;
+	MyFramebuffer target;
+	GLuint buffer;
+	GLsync fence;
+	State state;
+	std::chrono::steady_clock::time_point start;
+	ExportStats stats;
+
+	// the pixels being written, either the mapped buffer or rows, and the
+	// distance between rows; only touched by the writer thread while pending
+	// is set
+	std::thread writer;
+	std::mutex writerMutex;
+	std::condition_variable wake;
+	unsigned char *pixels;
+	std::vector<unsigned char> rows;
+	int stride;
+	bool pending;
+	bool written;
+	bool stopping;
+	std::function<void()> onReady;
+	WriteOptions writeOptions;
+	std::unique_ptr<WorkPool> pool;
+};
+
+#endif
@@ -0,0 +1,230 @@
+// ==========================================================================
+// Multi-pass filter graph over image-space render targets
+// ==========================================================================
+
+#include "filtergraph.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "trace.h"
+
+using namespace std;
+
+// intermediate results are kept in half floats so that effects pushing
+// colours outside [0, 1] keep working when chained, as they did in one pass
+const GLenum STAGE_FORMAT = GL_RGBA16F;
+
+static size_t TargetBytes(const MyFramebuffer &target)
+{
+	return TextureBytes(target.texture) * (target.texture.format == GL_RGBA16F ? 2 : 1);
+}
+
+// --------------------------------------------------------------------------
+// Render target pool
+
+MyFramebuffer RenderTargetPool::Acquire(int width, int height, GLenum format)
+{
+	for (Entry &entry : entries) {
+		const MyTexture &texture = entry.target.texture;
+		if (!entry.inUse && texture.width == width && texture.height == height
+			&& texture.format == format) {
+			entry.inUse = true;
+			entry.used = true;
+			stats.inUse++;
+			stats.peakInUse = max(stats.peakInUse, stats.inUse);
+			return entry.target;
+		}
+	}
+
+	Entry entry;
+	entry.inUse = true;
+	entry.used = true;
+	if (!InitializeFramebuffer(&entry.target, width, height, format)) {
+		DestroyFramebuffer(&entry.target);
+		return MyFramebuffer();
+	}
+	entries.push_back(entry);
+	stats.targets = entries.size();
+	stats.bytes += TargetBytes(entry.target);
+	stats.allocations++;
+	stats.inUse++;
+	stats.peakInUse = max(stats.peakInUse, stats.inUse);
+	return entry.target;
+}
+
+void RenderTargetPool::Release(const MyFramebuffer &target)
+{
+	if (target.framebuffer == 0) return;
+	for (Entry &entry : entries) {
+		if (entry.target.framebuffer == target.framebuffer && entry.inUse) {
+			entry.inUse = false;
+			stats.inUse--;
+			return;
+		}
+	}
+}
+
+void RenderTargetPool::Trim()
+{
+	for (size_t i = 0; i < entries.size();) {
+		Entry &entry = entries[i];
+		if (!entry.inUse && !entry.used) {
+			stats.bytes -= TargetBytes(entry.target);
+			DestroyFramebuffer(&entry.target);
+			entries.erase(entries.begin() + i);
+			continue;
+		}
+		entry.used = false;
+		i++;
+	}
+	stats.targets = entries.size();
+}
+
+void RenderTargetPool::Destroy()
+{
+	for (Entry &entry : entries)
+		DestroyFramebuffer(&entry.target);
+	entries.clear();
+	stats.targets = 0;
+	stats.inUse = 0;
+	stats.bytes = 0;
+}
+
+// --------------------------------------------------------------------------
+// Filter graph
+
+FilterGraph::FilterGraph() : programs("passvertex.glsl", "fragment.glsl"), timer(nullptr),
+	valid(false)
+{}
+
+bool FilterGraph::Initialize()
+{
+	return InitializeBlurPass(&blur);
+}
+
+void FilterGraph::Destroy()
+{
+	pool.Destroy();
+	output = MyFramebuffer();
+	valid = false;
+	programs.Destroy();
+	DestroyGeometry(&quad);
+	DestroyBlurPass(&blur);
+}
+
+int FilterGraph::AddStage(FilterStage stage)
+{
+	int index = int(stages.size());
+	if (stage.input < 0 || stage.input >= index)
+		stage.input = index - 1;
+	stages.push_back(stage);
+	return index;
+}
+
+// renders one non-blur stage through fragment.glsl compiled with only the
+// effect the stage applies
+void FilterGraph::RenderStage(const FilterStage &stage, const MyTexture &input, MyFramebuffer *target)
+{
+	string defines;
+	if (stage.kind == FilterStage::KERNEL)
+		defines = "#define FILTER_TYPE " + to_string(stage.type) + "\n";
+	else if (stage.kind == FilterStage::COLOUR)
+		defines = "#define GREY_SCALE " + to_string(stage.type) + "\n";
+	else
+		defines = "#define HUE 1\n";
+	MyShader *shader = programs.Get(defines);
+	if (shader == nullptr) return;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	glUseProgram(shader->program);
+	glBindVertexArray(quad.vertexArray);
+	glBindTexture(input.target, input.textureID);
+	glDrawArrays(GL_TRIANGLES, 0, quad.elementCount);
+
+	// reset state to default
+	glBindTexture(input.target, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+const MyTexture &FilterGraph::Run(const MyTexture &source)
+{
+	TRACE_SCOPE("FilterGraph::Run");
+	if (stages.empty()) {
+		pool.Release(output);
+		output = MyFramebuffer();
+		valid = false;
+		pool.Trim();
+		return source;
+	}
+	if (valid && output.framebuffer != 0 && source.textureID == lastSource.textureID
+		&& source.width == lastSource.width && source.height == lastSource.height
+		&& stages == lastStages) {
+		stats.reuses++;
+		return output.texture;
+	}
+	pool.Release(output);
+	output = MyFramebuffer();
+	valid = false;
+	stats.runs++;
+
+	int width = source.width;
+	int height = source.height;
+	if (!InitializeQuad(&quad, 1.f, 1.f, float(width), float(height)))
+		return source;
+
+	// count the readers of each stage, so its target can be released after
+	// the last one; the final stage is read by the caller
+	vector<int> readers(stages.size(), 0);
+	for (const FilterStage &stage : stages) {
+		if (stage.input >= 0) readers[stage.input]++;
+	}
+	readers.back()++;
+	vector<MyFramebuffer> targets(stages.size());
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, width, height);
+
+	for (size_t i = 0; i < stages.size(); i++) {
+		const FilterStage &stage = stages[i];
+		const MyTexture &input = stage.input < 0 ? source : targets[stage.input].texture;
+
+		// stages nobody reads are skipped
+		if (readers[i] == 0) continue;
+		targets[i] = pool.Acquire(width, height, STAGE_FORMAT);
+		if (targets[i].framebuffer == 0) break;
+
+		if (timer) timer->Begin(to_string(i + 1) + " " + StageName(stage), width * double(height) * 1e-6);
+		if (stage.kind == FilterStage::BLUR) {
+			MyFramebuffer scratch = pool.Acquire(width, height, STAGE_FORMAT);
+			if (scratch.framebuffer != 0)
+				RenderBlur(&blur, input, &scratch, &targets[i], quad, stage.type, stage.sigma);
+			pool.Release(scratch);
+		}
+		else {
+			RenderStage(stage, input, &targets[i]);
+		}
+		if (timer) timer->End();
+
+		if (stage.input >= 0 && --readers[stage.input] == 0)
+			pool.Release(targets[stage.input]);
+	}
+
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	CheckGLErrors();
+
+	// anything still held after a failure goes back to the pool
+	output = targets.back();
+	for (size_t i = 0; i + 1 < stages.size(); i++) {
+		if (readers[i] > 0) pool.Release(targets[i]);
+	}
+	pool.Trim();
+	if (output.framebuffer == 0) return source;
+	valid = true;
+	lastSource = source;
+	lastStages = stages;
+	return output.texture;
+}
@@ -0,0 +1,136 @@
+// ==========================================================================
+// Multi-pass filter graph over image-space render targets
+//
+// The effects applied to an image are a list of stages, each reading the
+// output of an earlier stage (or the source image) and rendering into its
+// own offscreen target at image resolution. Targets come from a pool keyed
+// by size and format, and a stage's target goes back to the pool as soon as
+// the last stage reading it has run. A plain chain therefore ping-pongs
+// between two targets, plus a scratch target for blurs, however many
+// stages it has.
+//
+// The output is kept between frames and only recomputed when the source or
+// the stages change, so panning, zooming and rotating a filtered image only
+// redraws the cached result.
+// ==========================================================================
+#ifndef FILTERGRAPH_H
+#define FILTERGRAPH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "boilerplate.h"
+#include "blurpass.h"
+#include "filterkernels.h"
+#include "gputimer.h"
+#include "programcache.h"
+
+// --------------------------------------------------------------------------
+// Pool of offscreen render targets shared by the stages
+
+struct RenderTargetStats
+{
+	size_t targets;		// allocated, whether in use or free
+	size_t inUse;
+	size_t peakInUse;
+	size_t bytes;
+	size_t allocations;
+
+	RenderTargetStats() : targets(0), inUse(0), peakInUse(0), bytes(0), allocations(0)
+	{}
+};
+
+class RenderTargetPool
+{
+public:
+	~RenderTargetPool() { Destroy(); }
+
+	// returns a target of the given size and format, reusing a free one when
+	// possible; its contents are undefined
+	MyFramebuffer Acquire(int width, int height, GLenum format);
+	void Release(const MyFramebuffer &target);
+
+	// deletes free targets that were not acquired since the last call, so
+	// targets of an old image size do not linger
+	void Trim();
+	void Destroy();
+
+	const RenderTargetStats &Stats() const { return stats; }
+
+private:
+	struct Entry
+	{
+		MyFramebuffer target;
+		bool inUse;
+		bool used;		// acquired since the last Trim()
+	};
+
+	std::vector<Entry> entries;
+	RenderTargetStats stats;
+};
+
+// --------------------------------------------------------------------------
+// Stages and the graph that runs them
+
+struct FilterGraphStats
+{
+	size_t runs;	// frames the stages were rendered
+	size_t reuses;	// frames the previous output was drawn again
+
+	FilterGraphStats() : runs(0), reuses(0)
+	{}
+};
+
+class FilterGraph
+{
+public:
+	FilterGraph();
+
+	bool Initialize();
+	void Destroy();
+
+	// adds a stage reading the previous one, or the source if it is the
+	// first, unless the stage names its input; returns the stage index
+	int AddStage(FilterStage stage);
+	void Clear() { stages.clear(); }
+
+	const std::vector<FilterStage> &Stages() const { return stages; }
+
+	// runs every stage over the source and returns the output of the last
+	// one, or the source itself if there are no stages; the output stays
+	// valid until the next call. If neither the source texture nor the stages
+	// changed since the last call, the previous output is returned as is.
+	const MyTexture &Run(const MyTexture &source);
+
+	// forces the next Run() to render, for when the contents of the source
+	// texture change without its name changing
+	void Invalidate() { valid = false; }
+
+	// times every stage rendered from now on, as "<index> <stage name>"
+	void SetTimer(GpuTimer *timer) { this->timer = timer; }
+
+	const RenderTargetStats &PoolStats() const { return pool.Stats(); }
+	const ProgramCache &Programs() const { return programs; }
+	const FilterGraphStats &Stats() const { return stats; }
+
+private:
+	void RenderStage(const FilterStage &stage, const MyTexture &input, MyFramebuffer *target);
+
+	BlurPass blur;
+	ProgramCache programs;
+	MyGeometry quad;
+	RenderTargetPool pool;
+	std::vector<FilterStage> stages;
+	GpuTimer *timer;
+
+	// output of the last run, handed back to the pool by the next one that
+	// renders, and what it was computed from
+	MyFramebuffer output;
+	bool valid;
+	MyTexture lastSource;
+	std::vector<FilterStage> lastStages;
+	FilterGraphStats stats;
+};
+
+#endif
@@ -0,0 +1,93 @@
+// ==========================================================================
+// Effect definitions shared by the GPU and CPU filter engines
+// ==========================================================================
+
+#include "filterkernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// 1D weights whose outer products give the original square kernels,
+// centre tap first
+static const int blurRadius[] = { 0, 1, 2, 3 };
+static const float blurWeights[][4] = {
+	{ 1.f, 0.f, 0.f, 0.f },
+	{ 0.6f, 0.2f, 0.f, 0.f },
+	{ 0.4f, 0.24f, 0.06f, 0.f },
+	{ 0.285f, 0.221f, 0.103f, 0.029f },
+};
+
+const float kernelWeights[4][9] = {
+	{ 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f },
+	{ -1.f, 0.f, 1.f, -2.f, 0.f, 2.f, -1.f, 0.f, 1.f },
+	{ -1.f, -2.f, -1.f, 0.f, 0.f, 0.f, 1.f, 2.f, 1.f },
+	{ 0.f, -1.f, 0.f, -1.f, 5.f, -1.f, 0.f, -1.f, 0.f },
+};
+
+vector<float> BlurWeights(int blurType, float sigma)
+{
+	if (blurType != GAUSSIAN_BLUR) {
+		if (blurType < 0 || blurType > 3) blurType = 0;
+		return vector<float>(blurWeights[blurType], blurWeights[blurType] + blurRadius[blurType] + 1);
+	}
+
+	sigma = max(sigma, 0.5f);
+	int radius = min(int(ceil(3.f * sigma)), MAX_BLUR_RADIUS);
+	vector<float> weights(radius + 1);
+	float sum = 0.f;
+	for (int i = 0; i <= radius; i++) {
+		weights[i] = exp(-float(i * i) / (2.f * sigma * sigma));
+		sum += i == 0 ? weights[i] : 2.f * weights[i];
+	}
+	for (float &w : weights)
+		w /= sum;
+	return weights;
+}
+
+string StageName(const FilterStage &stage)
+{
+	static const char *blurNames[] = { "none", "blur 3x3", "blur 5x5", "blur 7x7" };
+	static const char *kernelNames[] = { "none", "vertical sobel", "horizontal sobel", "unsharp" };
+	static const char *colourNames[] = { "none", "grey average", "grey rec601",
+		"grey rec709", "sepia", "grunge threshold", "negative" };
+
+	switch (stage.kind) {
+	case FilterStage::BLUR:
+		if (stage.type == GAUSSIAN_BLUR)
+			return "gaussian sigma " + to_string(stage.sigma);
+		return blurNames[stage.type];
+	case FilterStage::KERNEL:
+		return kernelNames[stage.type];
+	case FilterStage::COLOUR:
+		return colourNames[stage.type];
+	case FilterStage::HUE:
+		return "hue";
+	}
+	return "unknown";
+}
+
+int StageReach(const FilterStage &stage)
+{
+	if (stage.kind == FilterStage::BLUR)
+		return int(BlurWeights(stage.type, stage.sigma).size()) - 1;
+	return stage.kind == FilterStage::KERNEL ? 1 : 0;
+}
+
+int ChainReach(const vector<FilterStage> &stages)
+{
+	int reach = 0;
+	for (const FilterStage &stage : stages)
+		reach += StageReach(stage);
+	return reach;
+}
+
+void LinkStages(vector<FilterStage> *stages)
+{
+	for (size_t i = 0; i < stages->size(); i++) {
+		FilterStage &stage = (*stages)[i];
+		if (stage.input < 0 || stage.input >= int(i))
+			stage.input = int(i) - 1;
+	}
+}
@@ -0,0 +1,72 @@
+// ==========================================================================
+// Effect definitions shared by the GPU and CPU filter engines
+//
+// Stage descriptions and the blur weights used by both engines, kept free of
+// OpenGL so the CPU engine can be used without a context. The weights and
+// colour ratios of the other effects match those in fragment.glsl.
+// ==========================================================================
+#ifndef FILTERKERNELS_H
+#define FILTERKERNELS_H
+
+#include <string>
+#include <vector>
+
+// blurType values beyond the fixed 3x3, 5x5 and 7x7 kernels
+const int GAUSSIAN_BLUR = 4;
+
+// largest blur radius in texels
+const int MAX_BLUR_RADIUS = 64;
+
+// 1D blur weights from the centre outwards, weights[0] being the centre, for
+// the 3x3, 5x5 or 7x7 Gaussian selected by blurType (1 to 3) or, for
+// GAUSSIAN_BLUR, a normalized Gaussian of the given standard deviation in
+// texels truncated at three sigma or MAX_BLUR_RADIUS
+std::vector<float> BlurWeights(int blurType, float sigma);
+
+// 3x3 weights of the vertical Sobel, horizontal Sobel and unsharp filters
+// (filterType 1 to 3), listed from the upper left texel with up being +y
+extern const float kernelWeights[4][9];
+
+struct FilterStage
+{
+	enum Kind { BLUR, KERNEL, COLOUR, HUE };
+
+	Kind kind;
+	int type;		// blurType, filterType or greyScale value of the effect
+	float sigma;	// standard deviation of a GAUSSIAN_BLUR
+	int input;		// index of the stage read, or -1 for the source image
+
+	// red, green and blue offsets of a HUE stage; the shader reads them from
+	// the ViewState block, they are kept here to detect changes
+	float hue[3];
+
+	FilterStage(Kind kind, int type = 0, float sigma = 0.f, int input = -1)
+		: kind(kind), type(type), sigma(sigma), input(input), hue{ 0.f, 0.f, 0.f }
+	{}
+
+	bool operator==(const FilterStage &other) const
+	{
+		return kind == other.kind && type == other.type && sigma == other.sigma
+			&& input == other.input && hue[0] == other.hue[0]
+			&& hue[1] == other.hue[1] && hue[2] == other.hue[2];
+	}
+	bool operator!=(const FilterStage &other) const { return !(*this == other); }
+};
+
+// readable name of a stage such as "blur 5x5" or "sepia"
+std::string StageName(const FilterStage &stage);
+
+// texels a stage reads beyond the one it writes on each side: the blur
+// radius, one for the 3x3 kernels and none for point effects
+int StageReach(const FilterStage &stage);
+
+// width of the border a tile needs around the texels it keeps so they come
+// out as on the whole image; the reach of every stage added together, which
+// covers any path through stages reading earlier ones
+int ChainReach(const std::vector<FilterStage> &stages);
+
+// sets each stage without a valid input to read the one before it, as
+// FilterGraph::AddStage does
+void LinkStages(std::vector<FilterStage> *stages);
+
+#endif
@@ -0,0 +1,126 @@
+// ==========================================================================
+// GPU timer queries around render passes
+// ==========================================================================
+
+#include "gputimer.h"
+
+using namespace std;
+
+GpuTimer::GpuTimer() : next(0), current(-1), timing(false), enabled(false)
+{}
+
+bool GpuTimer::Initialize()
+{
+	// a timer with no bits never counts anything
+	GLint bits = 0;
+	glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+	enabled = bits > 0 && !CheckGLErrors();
+	return enabled;
+}
+
+void GpuTimer::Destroy()
+{
+	if (timing) glEndQuery(GL_TIME_ELAPSED);
+	for (QuerySet &set : ring) {
+		if (!set.queries.empty())
+			glDeleteQueries(GLsizei(set.queries.size()), set.queries.data());
+		set = QuerySet();
+	}
+	next = 0;
+	current = -1;
+	timing = false;
+	enabled = false;
+	ready.clear();
+}
+
+void GpuTimer::BeginFrame()
+{
+	if (!enabled) return;
+	EndFrame();
+	Poll();
+
+	// the set is still waiting for the GPU, and reading it now would stall
+	if (ring[next].pending) {
+		stats.skipped++;
+		return;
+	}
+	current = next;
+	next = (next + 1) % RING_SIZE;
+	ring[current].passes.clear();
+}
+
+void GpuTimer::EndFrame()
+{
+	End();
+	if (current < 0) return;
+	ring[current].pending = !ring[current].passes.empty();
+	current = -1;
+}
+
+void GpuTimer::Begin(const string &name, double megapixels)
+{
+	if (current < 0) return;
+	End();
+	QuerySet &set = ring[current];
+	if (set.passes.size() == set.queries.size()) {
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		set.queries.push_back(query);
+		stats.queries++;
+	}
+	PassTiming pass;
+	pass.name = name;
+	pass.megapixels = megapixels;
+	glBeginQuery(GL_TIME_ELAPSED, set.queries[set.passes.size()]);
+	set.passes.push_back(pass);
+	timing = true;
+}
+
+void GpuTimer::End()
+{
+	if (!timing) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	timing = false;
+}
+
+void GpuTimer::Collect(vector<FrameTiming> *frames)
+{
+	Poll();
+	for (FrameTiming &frame : ready)
+		frames->push_back(frame);
+	ready.clear();
+}
+
+// reads the sets in flight oldest first, stopping at the first one the GPU
+// has not finished so frames come out in order
+void GpuTimer::Poll()
+{
+	for (int i = 0; i < RING_SIZE; i++) {
+		QuerySet &set = ring[(next + i) % RING_SIZE];
+		if (!set.pending) continue;
+		if (!Read(&set)) return;
+	}
+}
+
+bool GpuTimer::Read(QuerySet *set)
+{
+	for (size_t i = 0; i < set->passes.size(); i++) {
+		GLuint available = 0;
+		glGetQueryObjectuiv(set->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) return false;
+	}
+
+	FrameTiming frame;
+	for (size_t i = 0; i < set->passes.size(); i++) {
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(set->queries[i], GL_QUERY_RESULT, &nanoseconds);
+		PassTiming pass = set->passes[i];
+		pass.ms = double(nanoseconds) * 1e-6;
+		frame.ms += pass.ms;
+		frame.passes.push_back(pass);
+	}
+	ready.push_back(frame);
+	set->pending = false;
+	stats.frames++;
+	return true;
+}
@@ -0,0 +1,102 @@
+// ==========================================================================
+// GPU timer queries around render passes
+//
+// Each pass of a frame is wrapped in a GL_TIME_ELAPSED query. Reading a
+// query's result right away would wait for the GPU to finish the frame, so
+// the queries of a frame are only read a few frames later: frames cycle
+// through a small ring of query sets, and results are collected once the
+// GPU reports them available. If the GPU falls so far behind that the next
+// set in the ring is still in flight, that frame is simply not timed.
+// ==========================================================================
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "boilerplate.h"
+
+struct PassTiming
+{
+	std::string name;
+	double ms;
+	double megapixels;	// pixels the pass wrote, for a throughput figure
+
+	PassTiming() : ms(0.0), megapixels(0.0)
+	{}
+};
+
+// every pass timed in one frame, and their sum
+struct FrameTiming
+{
+	std::vector<PassTiming> passes;
+	double ms;
+
+	FrameTiming() : ms(0.0)
+	{}
+};
+
+struct GpuTimerStats
+{
+	size_t frames;		// timed and collected
+	size_t skipped;		// not timed because the ring was full
+	size_t queries;		// query objects created
+
+	GpuTimerStats() : frames(0), skipped(0), queries(0)
+	{}
+};
+
+class GpuTimer
+{
+public:
+	GpuTimer();
+
+	// returns false if the GPU has no timer, in which case every other call
+	// does nothing
+	bool Initialize();
+	void Destroy();
+
+	// bracket the passes of one frame; BeginFrame() also collects the
+	// results of earlier frames that have arrived
+	void BeginFrame();
+	void EndFrame();
+
+	// times the commands issued until End() or the next Begin(), as queries
+	// of this kind cannot nest
+	void Begin(const std::string &name, double megapixels = 0.0);
+	void End();
+
+	// moves the frames whose results arrived since the last call, oldest
+	// first, into frames
+	void Collect(std::vector<FrameTiming> *frames);
+
+	bool Enabled() const { return enabled; }
+	const GpuTimerStats &Stats() const { return stats; }
+
+private:
+	static const int RING_SIZE = 4;
+
+	struct QuerySet
+	{
+		std::vector<GLuint> queries;	// grown as frames use more passes
+		std::vector<PassTiming> passes;
+		bool pending;					// issued and not yet read back
+
+		QuerySet() : pending(false)
+		{}
+	};
+
+	void Poll();
+	bool Read(QuerySet *set);
+
+	QuerySet ring[RING_SIZE];
+	int next;		// set the next frame uses, also the oldest one in flight
+	int current;	// set of the frame being recorded, or -1
+	bool timing;	// a query is open
+	bool enabled;
+	std::vector<FrameTiming> ready;
+	GpuTimerStats stats;
+};
+
+#endif
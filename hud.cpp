@@ -0,0 +1,208 @@
+// ==========================================================================
+// On-screen text overlay for performance figures
+// ==========================================================================
+
+#include "hud.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// printable ASCII from space to tilde, five columns per glyph with the top
+// row in the lowest bit
+const unsigned char GLYPHS[][5] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00}, {0x00, 0x07, 0x00, 0x07, 0x00},
+	{0x14, 0x7F, 0x14, 0x7F, 0x14}, {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+	{0x36, 0x49, 0x56, 0x20, 0x50}, {0x00, 0x08, 0x07, 0x03, 0x00}, {0x00, 0x1C, 0x22, 0x41, 0x00},
+	{0x00, 0x41, 0x22, 0x1C, 0x00}, {0x2A, 0x1C, 0x7F, 0x1C, 0x2A}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+	{0x00, 0x80, 0x70, 0x30, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08}, {0x00, 0x00, 0x60, 0x60, 0x00},
+	{0x20, 0x10, 0x08, 0x04, 0x02}, {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+	{0x72, 0x49, 0x49, 0x49, 0x46}, {0x21, 0x41, 0x49, 0x4D, 0x33}, {0x18, 0x14, 0x12, 0x7F, 0x10},
+	{0x27, 0x45, 0x45, 0x45, 0x39}, {0x3C, 0x4A, 0x49, 0x49, 0x31}, {0x41, 0x21, 0x11, 0x09, 0x07},
+	{0x36, 0x49, 0x49, 0x49, 0x36}, {0x46, 0x49, 0x49, 0x29, 0x1E}, {0x00, 0x00, 0x14, 0x00, 0x00},
+	{0x00, 0x40, 0x34, 0x00, 0x00}, {0x00, 0x08, 0x14, 0x22, 0x41}, {0x14, 0x14, 0x14, 0x14, 0x14},
+	{0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x59, 0x09, 0x06}, {0x3E, 0x41, 0x5D, 0x59, 0x4E},
+	{0x7C, 0x12, 0x11, 0x12, 0x7C}, {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+	{0x7F, 0x41, 0x41, 0x41, 0x3E}, {0x7F, 0x49, 0x49, 0x49, 0x41}, {0x7F, 0x09, 0x09, 0x09, 0x01},
+	{0x3E, 0x41, 0x41, 0x51, 0x73}, {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+	{0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41}, {0x7F, 0x40, 0x40, 0x40, 0x40},
+	{0x7F, 0x02, 0x1C, 0x02, 0x7F}, {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+	{0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E}, {0x7F, 0x09, 0x19, 0x29, 0x46},
+	{0x26, 0x49, 0x49, 0x49, 0x32}, {0x03, 0x01, 0x7F, 0x01, 0x03}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+	{0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F}, {0x63, 0x14, 0x08, 0x14, 0x63},
+	{0x03, 0x04, 0x78, 0x04, 0x03}, {0x61, 0x59, 0x49, 0x4D, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x41},
+	{0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x41, 0x7F}, {0x04, 0x02, 0x01, 0x02, 0x04},
+	{0x40, 0x40, 0x40, 0x40, 0x40}, {0x00, 0x03, 0x07, 0x08, 0x00}, {0x20, 0x54, 0x54, 0x78, 0x40},
+	{0x7F, 0x28, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x28}, {0x38, 0x44, 0x44, 0x28, 0x7F},
+	{0x38, 0x54, 0x54, 0x54, 0x18}, {0x00, 0x08, 0x7E, 0x09, 0x02}, {0x18, 0xA4, 0xA4, 0x9C, 0x78},
+	{0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00}, {0x20, 0x40, 0x40, 0x3D, 0x00},
+	{0x7F, 0x10, 0x28, 0x44, 0x00}, {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x78, 0x04, 0x78},
+	{0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38}, {0xFC, 0x18, 0x24, 0x24, 0x18},
+	{0x18, 0x24, 0x24, 0x18, 0xFC}, {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x24},
+	{0x04, 0x04, 0x3F, 0x44, 0x24}, {0x3C, 0x40, 0x40, 0x20, 0x7C}, {0x1C, 0x20, 0x40, 0x20, 0x1C},
+	{0x3C, 0x40, 0x30, 0x40, 0x3C}, {0x44, 0x28, 0x10, 0x28, 0x44}, {0x4C, 0x90, 0x90, 0x90, 0x7C},
+	{0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00}, {0x00, 0x00, 0x77, 0x00, 0x00},
+	{0x00, 0x41, 0x36, 0x08, 0x00}, {0x02, 0x01, 0x02, 0x04, 0x02}
+};
+const int GLYPH_COUNT = sizeof(GLYPHS) / sizeof(GLYPHS[0]);
+const char FIRST_GLYPH = ' ';
+
+// each glyph occupies a cell with a blank column and row of spacing, and
+// the cell after the last glyph is solid for drawing the background
+const int CELL_WIDTH = 6;
+const int CELL_HEIGHT = 9;
+const int FONT_WIDTH = (GLYPH_COUNT + 1) * CELL_WIDTH;
+const int FONT_HEIGHT = 8;
+
+// position, colour and texture coordinates of each vertex
+const int VERTEX_FLOATS = 8;
+const GLfloat TEXT_COLOUR[] = { 1.f, 1.f, 1.f, 1.f };
+const GLfloat BOX_COLOUR[] = { 0.f, 0.f, 0.f, 0.6f };
+
+// appends the two triangles of a quad from (x0, y0) to (x1, y1) in pixels,
+// with the texels from (s0, t0) to (s1, t1)
+void AddQuad(vector<GLfloat> *vertices, float x0, float y0, float x1, float y1,
+	float s0, float t0, float s1, float t1, const GLfloat *colour)
+{
+	const float corners[6][4] = {
+		{x0, y0, s0, t0}, {x0, y1, s0, t1}, {x1, y0, s1, t0},
+		{x0, y1, s0, t1}, {x1, y0, s1, t0}, {x1, y1, s1, t1}
+	};
+	for (const float *corner : corners) {
+		vertices->insert(vertices->end(), corner, corner + 2);
+		vertices->insert(vertices->end(), colour, colour + 4);
+		vertices->insert(vertices->end(), corner + 2, corner + 4);
+	}
+}
+
+}
+
+HudOverlay::HudOverlay() : vertexBuffer(0), vertexArray(0), viewportLocation(-1)
+{}
+
+bool HudOverlay::Initialize()
+{
+	if (!InitializeShaders(&shader, "hudvertex.glsl", "hudfragment.glsl"))
+		return false;
+	viewportLocation = glGetUniformLocation(shader.program, "viewportSize");
+
+	// unpack the glyphs into one row of cells, top row first
+	vector<unsigned char> texels(size_t(FONT_WIDTH) * FONT_HEIGHT, 0);
+	for (int glyph = 0; glyph < GLYPH_COUNT; glyph++) {
+		for (int column = 0; column < 5; column++) {
+			for (int row = 0; row < FONT_HEIGHT; row++) {
+				if (GLYPHS[glyph][column] & (1 << row))
+					texels[size_t(row) * FONT_WIDTH + glyph * CELL_WIDTH + column] = 255;
+			}
+		}
+	}
+	for (int row = 0; row < FONT_HEIGHT; row++) {
+		for (int column = 0; column < CELL_WIDTH; column++)
+			texels[size_t(row) * FONT_WIDTH + GLYPH_COUNT * CELL_WIDTH + column] = 255;
+	}
+
+	font.target = GL_TEXTURE_RECTANGLE;
+	font.format = GL_R8;
+	font.width = FONT_WIDTH;
+	font.height = FONT_HEIGHT;
+	glGenTextures(1, &font.textureID);
+	glBindTexture(font.target, font.textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(font.target, 0, GL_R8, FONT_WIDTH, FONT_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE,
+		texels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(font.target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(font.target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(font.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(font.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(font.target, 0);
+
+	// these vertex attribute indices correspond to those specified for the
+	// input variables in hudvertex.glsl
+	const GLuint VERTEX_INDEX = 0;
+	const GLuint COLOUR_INDEX = 1;
+	const GLuint TEXTURE_INDEX = 2;
+	const GLsizei stride = VERTEX_FLOATS * sizeof(GLfloat);
+
+	glGenBuffers(1, &vertexBuffer);
+	glGenVertexArrays(1, &vertexArray);
+	glBindVertexArray(vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glVertexAttribPointer(VERTEX_INDEX, 2, GL_FLOAT, GL_FALSE, stride, 0);
+	glEnableVertexAttribArray(VERTEX_INDEX);
+	glVertexAttribPointer(COLOUR_INDEX, 4, GL_FLOAT, GL_FALSE, stride,
+		reinterpret_cast<const void *>(2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(COLOUR_INDEX);
+	glVertexAttribPointer(TEXTURE_INDEX, 2, GL_FLOAT, GL_FALSE, stride,
+		reinterpret_cast<const void *>(6 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(TEXTURE_INDEX);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	return !CheckGLErrors();
+}
+
+void HudOverlay::Destroy()
+{
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &vertexArray);
+	glDeleteBuffers(1, &vertexBuffer);
+	vertexArray = 0;
+	vertexBuffer = 0;
+	DestroyTexture(&font);
+	DestroyShaders(&shader);
+	shader = MyShader();
+	vector<GLfloat>().swap(vertices);
+}
+
+void HudOverlay::Draw(const vector<string> &lines, int scale)
+{
+	if (shader.program == 0 || lines.empty()) return;
+
+	size_t longest = 0;
+	for (const string &line : lines) longest = max(longest, line.size());
+	const float cellWidth = float(CELL_WIDTH * scale);
+	const float cellHeight = float(CELL_HEIGHT * scale);
+	const float margin = float(4 * scale);
+
+	// the box first, so the text blends over it
+	vertices.clear();
+	AddQuad(&vertices, margin, margin, 3.f * margin + longest * cellWidth,
+		3.f * margin + lines.size() * cellHeight, GLYPH_COUNT * CELL_WIDTH + 0.5f, 0.5f,
+		GLYPH_COUNT * CELL_WIDTH + 0.5f, 0.5f, BOX_COLOUR);
+	for (size_t row = 0; row < lines.size(); row++) {
+		float y = 2.f * margin + row * cellHeight;
+		for (size_t column = 0; column < lines[row].size(); column++) {
+			int glyph = lines[row][column] - FIRST_GLYPH;
+			if (glyph <= 0 || glyph >= GLYPH_COUNT) continue;
+			float x = 2.f * margin + column * cellWidth;
+			float s = float(glyph * CELL_WIDTH);
+			AddQuad(&vertices, x, y, x + cellWidth, y + FONT_HEIGHT * scale,
+				s, 0.f, s + CELL_WIDTH, float(FONT_HEIGHT), TEXT_COLOUR);
+		}
+	}
+
+	// the buffer is orphaned every frame, so the driver never waits for the
+	// GPU to finish drawing the previous frame's text
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glUseProgram(shader.program);
+	glUniform2f(viewportLocation, float(viewport[2]), float(viewport[3]));
+	glBindVertexArray(vertexArray);
+	glBindTexture(font.target, font.textureID);
+	glDrawArrays(GL_TRIANGLES, 0, GLsizei(vertices.size() / VERTEX_FLOATS));
+
+	// reset state to default
+	glBindTexture(font.target, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glDisable(GL_BLEND);
+}
@@ -0,0 +1,39 @@
+// ==========================================================================
+// On-screen text overlay for performance figures
+//
+// Lines of text are drawn in the top-left corner of the window over a
+// translucent box, using a 5x7 pixel font built into the program so that no
+// font file or library is needed. The glyphs live in one small rectangle
+// texture and each frame's text is written into a stream buffer as a quad
+// per character, which is a single draw call.
+// ==========================================================================
+#ifndef HUD_H
+#define HUD_H
+
+#include <string>
+#include <vector>
+
+#include "boilerplate.h"
+
+class HudOverlay
+{
+public:
+	HudOverlay();
+
+	bool Initialize();
+	void Destroy();
+
+	// draws the lines into the current framebuffer, scaled up by a whole
+	// number of pixels per font pixel
+	void Draw(const std::vector<std::string> &lines, int scale = 2);
+
+private:
+	MyShader shader;
+	MyTexture font;
+	GLuint vertexBuffer;
+	GLuint vertexArray;
+	GLint viewportLocation;
+	std::vector<GLfloat> vertices;
+};
+
+#endif
@@ -0,0 +1,19 @@
+// ==========================================================================
+// Fragment program for the performance HUD
+//
+// The font texture holds coverage in its red channel, which becomes the
+// opacity of the vertex colour; the background box samples a solid texel.
+// ==========================================================================
+#version 410
+
+in vec2 textureCoords;
+in vec4 colour;
+
+out vec4 FragmentColour;
+
+uniform sampler2DRect tex;
+
+void main()
+{
+	FragmentColour = vec4(colour.rgb, colour.a * texture(tex, textureCoords).r);
+}
@@ -0,0 +1,25 @@
+// ==========================================================================
+// Vertex program for the performance HUD
+//
+// Positions are in window pixels from the top-left corner, and texture
+// coordinates in texels of the font texture.
+// ==========================================================================
+#version 410
+
+// location indices match those used by HudOverlay::Initialize()
+layout(location = 0) in vec2 VertexPosition;
+layout(location = 1) in vec4 VertexColour;
+layout(location = 2) in vec2 VertexTexture;
+
+out vec2 textureCoords;
+out vec4 colour;
+
+uniform vec2 viewportSize;
+
+void main()
+{
+	vec2 clip = VertexPosition / viewportSize * 2.0 - 1.0;
+	gl_Position = vec4(clip.x, -clip.y, 0.0, 1.0);
+	textureCoords = VertexTexture;
+	colour = VertexColour;
+}
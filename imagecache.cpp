@@ -0,0 +1,156 @@
+// ==========================================================================
+// Decoded image and texture caches
+// ==========================================================================
+
+#include "imagecache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <vector>
+#include <stb_image.h>
+
+#include "mappedfile.h"
+#include "trace.h"
+
+using namespace std;
+
+DecodedImage::~DecodedImage()
+{
+	if (pixels) stbi_image_free(pixels);
+}
+
+namespace {
+
+double Seconds(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// rows are flipped here rather than by stb_image, whose flip flag is global
+// to every decoding thread and whose cost could not be told apart from the
+// decode; both swap rows through a buffer the same way
+shared_ptr<DecodedImage> Flipped(shared_ptr<DecodedImage> image, LoadProfile *profile)
+{
+	auto start = chrono::steady_clock::now();
+	FlipRows(image.get());
+	if (profile) {
+		profile->flipSeconds = Seconds(start);
+		profile->pixels = size_t(image->width) * image->height;
+		profile->width = image->width;
+		profile->height = image->height;
+		profile->components = image->components;
+	}
+	return image;
+}
+
+}
+
+shared_ptr<DecodedImage> DecodeImage(const char *filename, LoadProfile *profile)
+{
+	if (profile) {
+		*profile = LoadProfile();
+		profile->path = filename;
+	}
+
+	// files that cannot be mapped, such as pipes, are read as before
+	MappedFile file;
+	auto start = chrono::steady_clock::now();
+	if (file.Open(filename, profile != nullptr)) {
+		if (profile) {
+			// touching a byte of every page waits for the whole file to be
+			// in memory, so the decode that follows never touches the disk
+			const size_t PAGE_SIZE = 4096;
+			unsigned char sum = 0;
+			for (size_t offset = 0; offset < file.Size(); offset += PAGE_SIZE)
+				sum += static_cast<const volatile unsigned char *>(file.Data())[offset];
+			(void)sum;
+			profile->fileBytes = file.Size();
+			profile->readSeconds = Seconds(start);
+		}
+		return DecodeImage(file.Data(), file.Size(), profile);
+	}
+
+	start = chrono::steady_clock::now();
+	shared_ptr<DecodedImage> image = make_shared<DecodedImage>();
+	image->pixels = stbi_load(filename, &image->width, &image->height, &image->components, 0);
+	if (image->pixels == nullptr) return nullptr;
+	if (profile) profile->decodeSeconds = Seconds(start);
+	return Flipped(image, profile);
+}
+
+shared_ptr<DecodedImage> DecodeImage(const unsigned char *data, size_t size, LoadProfile *profile)
+{
+	TRACE_SCOPE("DecodeImage");
+	if (size > size_t(INT_MAX)) return nullptr;
+	auto start = chrono::steady_clock::now();
+	shared_ptr<DecodedImage> image = make_shared<DecodedImage>();
+	image->pixels = stbi_load_from_memory(data, int(size), &image->width, &image->height,
+		&image->components, 0);
+	if (image->pixels == nullptr) return nullptr;
+	if (profile) profile->decodeSeconds = Seconds(start);
+	return Flipped(image, profile);
+}
+
+void FlipRows(DecodedImage *image)
+{
+	size_t rowBytes = size_t(image->width) * image->components;
+	vector<unsigned char> swap(rowBytes);
+	for (int top = 0, bottom = image->height - 1; top < bottom; top++, bottom--) {
+		unsigned char *a = image->pixels + top * rowBytes;
+		unsigned char *b = image->pixels + bottom * rowBytes;
+		memcpy(swap.data(), a, rowBytes);
+		memcpy(a, b, rowBytes);
+		memcpy(b, swap.data(), rowBytes);
+	}
+}
+
+shared_ptr<DecodedImage> ReduceImage(const DecodedImage &image, int maxSize)
+{
+	int factor = max((image.width + maxSize - 1) / maxSize, (image.height + maxSize - 1) / maxSize);
+	factor = max(factor, 1);
+	int components = image.components;
+	shared_ptr<DecodedImage> reduced = make_shared<DecodedImage>();
+	reduced->width = (image.width + factor - 1) / factor;
+	reduced->height = (image.height + factor - 1) / factor;
+	reduced->components = components;
+	// the destructor frees it with stbi_image_free, which is plain free()
+	reduced->pixels = static_cast<unsigned char *>(malloc(reduced->ByteSize()));
+	if (reduced->pixels == nullptr) return nullptr;
+
+	// sum whole rows of blocks at a time, blocks at the right and top edges
+	// averaging only the pixels that exist
+	vector<unsigned> sums(size_t(reduced->width) * components);
+	for (int y = 0; y < reduced->height; y++) {
+		fill(sums.begin(), sums.end(), 0u);
+		int rows = min(factor, image.height - y * factor);
+		for (int j = 0; j < rows; j++) {
+			const unsigned char *in = image.pixels + (size_t(y) * factor + j) * image.width * components;
+			for (int x = 0; x < image.width; x++) {
+				for (int c = 0; c < components; c++)
+					sums[size_t(x / factor) * components + c] += in[size_t(x) * components + c];
+			}
+		}
+		unsigned char *out = reduced->pixels + size_t(y) * reduced->width * components;
+		for (int x = 0; x < reduced->width; x++) {
+			unsigned count = unsigned(rows * min(factor, image.width - x * factor));
+			for (int c = 0; c < components; c++) {
+				size_t i = size_t(x) * components + c;
+				out[i] = (unsigned char)((sums[i] + count / 2) / count);
+			}
+		}
+	}
+	return reduced;
+}
+
+string ImageKey(const char *filename)
+{
+	struct stat info;
+	long long mtime = 0;
+	if (stat(filename, &info) == 0)
+		mtime = (long long)info.st_mtime;
+	return string(filename) + "@" + to_string(mtime);
+}
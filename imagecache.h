@@ -0,0 +1,225 @@
+// ==========================================================================
+// Decoded image and texture caches
+//
+// Images are keyed by path and file modification time, so an edited file on
+// disk is treated as a new image. Both caches evict the least recently used
+// entry once their byte budget is exceeded.
+// ==========================================================================
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// --------------------------------------------------------------------------
+// Pixel data as returned by stbi_load, freed with the object
+
+struct DecodedImage
+{
+	unsigned char *pixels;
+	int width;
+	int height;
+	int components;
+
+	// a reduced copy small enough to be a texture, made when the image is
+	// larger than the GPU can hold; filters run on the image itself in tiles
+	std::shared_ptr<DecodedImage> preview;
+
+	DecodedImage() : pixels(nullptr), width(0), height(0), components(0)
+	{}
+	~DecodedImage();
+
+	size_t ByteSize() const
+	{
+		return size_t(width) * height * components + (preview ? preview->ByteSize() : 0);
+	}
+
+private:
+	DecodedImage(const DecodedImage &);
+	DecodedImage &operator=(const DecodedImage &);
+};
+
+// time spent in each phase of loading one image, measured with a monotonic
+// clock; the decoders leave the upload to the caller
+struct LoadProfile
+{
+	std::string path;
+	size_t fileBytes;		// read from the file, zero if it could not be mapped
+	size_t pixels;			// decoded
+	int width;
+	int height;
+	int components;
+	double readSeconds;		// mapping the file and faulting in its pages
+	double decodeSeconds;	// stb_image, top row first
+	double flipSeconds;		// reversing the rows to OpenGL's bottom-up order
+	double uploadSeconds;	// glTexImage2D until the GPU has the pixels
+
+	LoadProfile() : fileBytes(0), pixels(0), width(0), height(0), components(0), readSeconds(0.0),
+		decodeSeconds(0.0), flipSeconds(0.0), uploadSeconds(0.0)
+	{}
+
+	double Megapixels() const { return pixels / 1e6; }
+	double TotalSeconds() const { return readSeconds + decodeSeconds + flipSeconds + uploadSeconds; }
+};
+
+// decodes the named file from a memory mapping of it, returning null if it
+// could not be loaded; given a profile, the whole file is read in before
+// decoding so the two are timed apart
+std::shared_ptr<DecodedImage> DecodeImage(const char *filename, LoadProfile *profile = nullptr);
+
+// decodes a file already in memory, such as a MappedFile
+std::shared_ptr<DecodedImage> DecodeImage(const unsigned char *data, size_t size,
+	LoadProfile *profile = nullptr);
+
+// reverses the order of the rows in place; images are decoded top row first
+// and flipped to the bottom-up order OpenGL expects
+void FlipRows(DecodedImage *image);
+
+// averages blocks of the smallest whole number of pixels that brings both
+// sides to at most maxSize
+std::shared_ptr<DecodedImage> ReduceImage(const DecodedImage &image, int maxSize);
+
+// builds the cache key for a file from its path and modification time
+std::string ImageKey(const char *filename);
+
+// --------------------------------------------------------------------------
+// Generic least-recently-used cache with a byte budget
+
+struct CacheStats
+{
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t bytes;
+	size_t budget;
+	size_t entries;
+
+	CacheStats() : hits(0), misses(0), evictions(0), bytes(0), budget(0), entries(0)
+	{}
+};
+
+template <class Value>
+class LruCache
+{
+public:
+	typedef std::function<void(Value &)> EvictFunction;
+
+	explicit LruCache(size_t budget, EvictFunction onEvict = EvictFunction())
+		: onEvict(onEvict)
+	{
+		stats.budget = budget;
+	}
+
+	~LruCache() { Clear(); }
+
+	// looks up a key, marking it most recently used on a hit
+	bool Find(const std::string &key, Value *value)
+	{
+		auto it = index.find(key);
+		if (it == index.end()) {
+			stats.misses++;
+			return false;
+		}
+		entries.splice(entries.begin(), entries, it->second);
+		stats.hits++;
+		*value = it->second->value;
+		return true;
+	}
+
+	bool Contains(const std::string &key) const
+	{
+		return index.find(key) != index.end();
+	}
+
+	// inserts or replaces an entry, then evicts until back under budget; the
+	// new entry itself is never evicted so a single oversized image still
+	// works, and neither is the entry under keep, e.g. the one in use
+	void Insert(const std::string &key, const Value &value, size_t bytes,
+		const std::string &keep = std::string())
+	{
+		Erase(key);
+		entries.push_front(Entry{ key, value, bytes });
+		index[key] = entries.begin();
+		stats.bytes += bytes;
+		stats.entries = entries.size();
+		Trim(1, keep);
+	}
+
+	// evicts the least recently used entry other than the given key,
+	// returning false if there is no such entry
+	bool EvictOldest(const std::string &except)
+	{
+		for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+			if (it->key == except) continue;
+			Remove(std::prev(it.base()));
+			stats.evictions++;
+			return true;
+		}
+		return false;
+	}
+
+	void Erase(const std::string &key)
+	{
+		auto it = index.find(key);
+		if (it == index.end()) return;
+		Remove(it->second);
+	}
+
+	void Clear()
+	{
+		while (!entries.empty())
+			Remove(std::prev(entries.end()));
+	}
+
+	void SetBudget(size_t budget)
+	{
+		stats.budget = budget;
+		Trim(0, std::string());
+	}
+
+	const CacheStats &Stats() const { return stats; }
+
+private:
+	struct Entry
+	{
+		std::string key;
+		Value value;
+		size_t bytes;
+	};
+	typedef typename std::list<Entry>::iterator EntryIterator;
+
+	void Remove(EntryIterator entry)
+	{
+		if (onEvict) onEvict(entry->value);
+		stats.bytes -= entry->bytes;
+		index.erase(entry->key);
+		entries.erase(entry);
+		stats.entries = entries.size();
+	}
+
+	// evicts from the cold end, keeping at least the given number of the
+	// most recently used entries and the entry under except
+	void Trim(size_t keep, const std::string &except)
+	{
+		while (stats.bytes > stats.budget && entries.size() > keep) {
+			EntryIterator victim = std::prev(entries.end());
+			if (victim->key == except) {
+				if (entries.size() <= keep + 1) break;
+				victim = std::prev(victim);
+			}
+			Remove(victim);
+			stats.evictions++;
+		}
+	}
+
+	std::list<Entry> entries;
+	std::unordered_map<std::string, EntryIterator> index;
+	EvictFunction onEvict;
+	CacheStats stats;
+};
+
+#endif
@@ -0,0 +1,843 @@
+// ==========================================================================
+// Encoding and writing images in several file formats
+// ==========================================================================
+
+#include "imagewrite.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <zlib.h>
+
+#include "trace.h"
+#include "workpool.h"
+
+using namespace std;
+
+namespace
+{
+	// a band should hold enough rows that its deflate stream or entropy
+	// coder warms up; smaller images are encoded in one band
+	const size_t MIN_BAND_BYTES = 256 << 10;
+
+	// bands per thread, so stolen bands even out uneven compression
+	const int BANDS_PER_THREAD = 4;
+
+	const int DEFLATE_WINDOW = 32768;
+
+	double Seconds(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// rows of the source in file order, whatever the sign of the stride
+	struct SourceRows
+	{
+		const unsigned char *data;
+		ptrdiff_t stride;
+
+		const unsigned char *Row(int y) const { return data + stride * y; }
+	};
+
+	// number of bands to split rows of the given size into
+	int BandCount(int rows, size_t rowBytes, WorkPool *pool)
+	{
+		if (!pool || rows <= 1) return 1;
+		int minRows = int(max<size_t>(1, MIN_BAND_BYTES / max<size_t>(1, rowBytes)));
+		int bands = min(int(pool->Threads()) * BANDS_PER_THREAD, rows / minRows);
+		return max(1, bands);
+	}
+
+	void RunBands(WorkPool *pool, int bands, const function<void(int)> &task)
+	{
+		if (pool && bands > 1)
+			pool->Run(size_t(bands), [&](size_t band, unsigned) { task(int(band)); });
+		else {
+			for (int band = 0; band < bands; band++)
+				task(band);
+		}
+	}
+
+	void Put16(vector<unsigned char> *out, unsigned value)
+	{
+		out->push_back((unsigned char)(value >> 8));
+		out->push_back((unsigned char)value);
+	}
+
+	void Put32(vector<unsigned char> *out, uint32_t value)
+	{
+		Put16(out, value >> 16);
+		Put16(out, value & 0xffff);
+	}
+
+	void PutText(vector<unsigned char> *out, const char *text)
+	{
+		out->insert(out->end(), text, text + strlen(text));
+	}
+
+	bool WriteFile(const string &path, const vector<vector<unsigned char>> &pieces)
+	{
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file) return false;
+		bool ok = true;
+		for (const vector<unsigned char> &piece : pieces) {
+			if (!piece.empty() && fwrite(piece.data(), 1, piece.size(), file) != piece.size())
+				ok = false;
+		}
+		return fclose(file) == 0 && ok;
+	}
+
+	// ----------------------------------------------------------------------
+	// PNG
+
+	unsigned char Paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+		if (pa <= pb && pa <= pc) return (unsigned char)a;
+		return (unsigned char)(pb <= pc ? b : c);
+	}
+
+	// applies one PNG filter to a row of n bytes; prev is the row above,
+	// all zero for the first row
+	void FilterRow(int type, const unsigned char *row, const unsigned char *prev, int bpp,
+		size_t n, unsigned char *out)
+	{
+		size_t first = min(size_t(bpp), n);
+		switch (type) {
+		case PNG_FILTER_NONE:
+			memcpy(out, row, n);
+			break;
+		case PNG_FILTER_SUB:
+			memcpy(out, row, first);
+			for (size_t i = first; i < n; i++) out[i] = row[i] - row[i - bpp];
+			break;
+		case PNG_FILTER_UP:
+			for (size_t i = 0; i < n; i++) out[i] = row[i] - prev[i];
+			break;
+		case PNG_FILTER_AVERAGE:
+			for (size_t i = 0; i < first; i++) out[i] = row[i] - (prev[i] >> 1);
+			for (size_t i = first; i < n; i++) out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+			break;
+		case PNG_FILTER_PAETH:
+			for (size_t i = 0; i < first; i++) out[i] = row[i] - prev[i];
+			for (size_t i = first; i < n; i++)
+				out[i] = row[i] - Paeth(row[i - bpp], prev[i], prev[i - bpp]);
+			break;
+		}
+	}
+
+	// filters a row into out, preceded by its filter type byte
+	void FilterPngRow(PngFilter filter, const unsigned char *row, const unsigned char *prev,
+		int bpp, size_t n, unsigned char *scratch, unsigned char *out)
+	{
+		if (filter != PNG_FILTER_ADAPTIVE) {
+			out[0] = (unsigned char)filter;
+			FilterRow(filter, row, prev, bpp, n, out + 1);
+			return;
+		}
+
+		// the smallest sum of the filtered bytes taken as signed values
+		// predicts the smallest output
+		int best = PNG_FILTER_NONE;
+		size_t bestSum = ~size_t(0);
+		for (int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+			unsigned char *candidate = scratch + type * n;
+			FilterRow(type, row, prev, bpp, n, candidate);
+			size_t sum = 0;
+			for (size_t i = 0; i < n; i++)
+				sum += size_t(abs(int((signed char)candidate[i])));
+			if (sum < bestSum) {
+				bestSum = sum;
+				best = type;
+			}
+		}
+		out[0] = (unsigned char)best;
+		memcpy(out + 1, scratch + best * n, n);
+	}
+
+	struct PngBand
+	{
+		vector<unsigned char> chunk;	// IDAT chunk: length, tag, data and CRC
+		uLong adler;
+		size_t bytes;					// filtered bytes compressed
+		bool ok;
+	};
+
+	// deflates a band of filtered rows into the data of an IDAT chunk; each
+	// band but the last ends with a sync flush on a byte boundary, so the
+	// bands concatenate into one deflate stream
+	bool DeflateBand(const unsigned char *data, size_t size, const unsigned char *dictionary,
+		size_t dictionarySize, bool last, const WriteOptions &options, vector<unsigned char> *out)
+	{
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		int strategy = options.pngFilter == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+		if (deflateInit2(&stream, options.pngLevel, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+			return false;
+		if (dictionarySize > 0)
+			deflateSetDictionary(&stream, dictionary, uInt(dictionarySize));
+
+		size_t start = out->size();
+		out->resize(start + deflateBound(&stream, uLong(size)) + 16);
+		stream.next_in = const_cast<unsigned char *>(data);
+		stream.avail_in = uInt(size);
+		stream.next_out = out->data() + start;
+		stream.avail_out = uInt(out->size() - start);
+		int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+		bool ok = last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0
+			&& stream.avail_out > 0);
+		out->resize(start + stream.total_out);
+		deflateEnd(&stream);
+		return ok;
+	}
+
+	bool EncodePng(int width, int height, const SourceRows &rows, int components,
+		const WriteOptions &options, vector<vector<unsigned char>> *pieces, int *bandCount)
+	{
+		static const unsigned char colourTypes[] = { 0, 0, 4, 2, 6 };
+		size_t rowBytes = size_t(width) * components;
+		size_t lineBytes = rowBytes + 1;
+		int bands = BandCount(height, lineBytes, options.pool);
+		*bandCount = bands;
+
+		// filter all rows first, so every band can be primed with the end of
+		// the band before it
+		vector<unsigned char> filtered(lineBytes * height);
+		vector<unsigned char> zeros(rowBytes, 0);
+		PngFilter filter = options.pngLevel == 0 ? PNG_FILTER_NONE : options.pngFilter;
+		RunBands(options.pool, bands, [&](int band) {
+			vector<unsigned char> scratch(filter == PNG_FILTER_ADAPTIVE ? 5 * rowBytes : 0);
+			int y0 = int(int64_t(height) * band / bands);
+			int y1 = int(int64_t(height) * (band + 1) / bands);
+			for (int y = y0; y < y1; y++) {
+				FilterPngRow(filter, rows.Row(y), y > 0 ? rows.Row(y - 1) : zeros.data(), components,
+					rowBytes, scratch.data(), filtered.data() + lineBytes * y);
+			}
+		});
+
+		vector<PngBand> compressed(bands);
+		RunBands(options.pool, bands, [&](int band) {
+			size_t begin = lineBytes * size_t(int64_t(height) * band / bands);
+			size_t end = lineBytes * size_t(int64_t(height) * (band + 1) / bands);
+			size_t dictionary = min(begin, size_t(DEFLATE_WINDOW));
+			PngBand &out = compressed[band];
+			out.bytes = end - begin;
+			out.adler = adler32(adler32(0L, Z_NULL, 0), filtered.data() + begin, uInt(out.bytes));
+
+			// the chunk length is filled in once the data is compressed; the
+			// zlib header goes at the start of the first band
+			out.chunk.resize(4);
+			PutText(&out.chunk, "IDAT");
+			if (band == 0) {
+				int levelFlag = options.pngLevel < 2 ? 0 : (options.pngLevel < 6 ? 1
+					: (options.pngLevel == 6 ? 2 : 3));
+				unsigned header = 0x7800 | (levelFlag << 6);
+				Put16(&out.chunk, header + (31 - header % 31) % 31);
+			}
+			out.ok = DeflateBand(filtered.data() + begin, out.bytes, filtered.data() + begin - dictionary,
+				dictionary, band == bands - 1, options, &out.chunk);
+		});
+
+		// the stream ends with the checksum of all the filtered bytes
+		uLong adler = compressed[0].adler;
+		for (int band = 1; band < bands; band++)
+			adler = adler32_combine(adler, compressed[band].adler, z_off_t(compressed[band].bytes));
+		Put32(&compressed[bands - 1].chunk, uint32_t(adler));
+
+		vector<unsigned char> header;
+		const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+		header.insert(header.end(), signature, signature + 8);
+		Put32(&header, 13);
+		PutText(&header, "IHDR");
+		Put32(&header, uint32_t(width));
+		Put32(&header, uint32_t(height));
+		header.push_back(8);
+		header.push_back(colourTypes[components]);
+		header.push_back(0);
+		header.push_back(0);
+		header.push_back(0);
+		Put32(&header, uint32_t(crc32(0L, header.data() + 12, 17)));
+		pieces->push_back(header);
+
+		for (PngBand &band : compressed) {
+			if (!band.ok) return false;
+			vector<unsigned char> &chunk = band.chunk;
+			uint32_t length = uint32_t(chunk.size() - 8);
+			chunk[0] = (unsigned char)(length >> 24);
+			chunk[1] = (unsigned char)(length >> 16);
+			chunk[2] = (unsigned char)(length >> 8);
+			chunk[3] = (unsigned char)length;
+			Put32(&chunk, uint32_t(crc32(0L, chunk.data() + 4, uInt(chunk.size() - 4))));
+			pieces->push_back(vector<unsigned char>());
+			pieces->back().swap(chunk);
+		}
+
+		vector<unsigned char> end;
+		Put32(&end, 0);
+		PutText(&end, "IEND");
+		Put32(&end, uint32_t(crc32(0L, end.data() + 4, 4)));
+		pieces->push_back(end);
+		return true;
+	}
+
+	// ----------------------------------------------------------------------
+	// JPEG
+
+	const unsigned char ZIGZAG[64] = {
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+	};
+
+	// quantization tables of the JPEG standard, annex K, in natural order
+	const unsigned char LUMA_QUANT[64] = {
+		16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+		14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+		18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+		49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+	};
+	const unsigned char CHROMA_QUANT[64] = {
+		17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+		24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+		99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+	};
+
+	// Huffman tables of the standard as code counts per length and values
+	const unsigned char LUMA_DC_COUNTS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+	const unsigned char CHROMA_DC_COUNTS[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+	const unsigned char DC_VALUES[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+	const unsigned char LUMA_AC_COUNTS[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+	const unsigned char LUMA_AC_VALUES[162] = {
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+		0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+		0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+		0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+		0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+		0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+		0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+		0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa
+	};
+	const unsigned char CHROMA_AC_COUNTS[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+	const unsigned char CHROMA_AC_VALUES[162] = {
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+		0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+		0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+		0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+		0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+		0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+		0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+		0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+		0xf9, 0xfa
+	};
+
+	struct HuffmanCode
+	{
+		unsigned short code;
+		unsigned char length;
+	};
+
+	struct HuffmanTable
+	{
+		HuffmanCode codes[256];
+
+		void Build(const unsigned char *counts, const unsigned char *values)
+		{
+			memset(codes, 0, sizeof(codes));
+			unsigned code = 0;
+			int k = 0;
+			for (int length = 1; length <= 16; length++) {
+				for (int i = 0; i < counts[length - 1]; i++, k++) {
+					codes[values[k]].code = (unsigned short)code++;
+					codes[values[k]].length = (unsigned char)length;
+				}
+				code <<= 1;
+			}
+		}
+	};
+
+	// one quantization table and the Huffman tables for a component kind
+	struct JpegComponent
+	{
+		unsigned char quant[64];	// zigzag order, as written to the file
+		float scale[64];			// natural order, including the DCT scaling
+		HuffmanTable dc;
+		HuffmanTable ac;
+	};
+
+	void BuildComponent(JpegComponent *component, const unsigned char *baseQuant, int quality,
+		const unsigned char *dcCounts, const unsigned char *acCounts, const unsigned char *acValues)
+	{
+		// the scaled AAN DCT leaves each coefficient multiplied by these
+		static const float aan[8] = { 1.f, 1.387039845f, 1.306562965f, 1.175875602f,
+			1.f, 0.785694958f, 0.541196100f, 0.275899379f };
+		quality = min(max(quality, 1), 100);
+		int factor = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+		for (int k = 0; k < 64; k++) {
+			int natural = ZIGZAG[k];
+			int q = min(max((baseQuant[natural] * factor + 50) / 100, 1), 255);
+			component->quant[k] = (unsigned char)q;
+			component->scale[natural] = 1.f / (q * aan[natural / 8] * aan[natural % 8] * 8.f);
+		}
+		component->dc.Build(dcCounts, DC_VALUES);
+		component->ac.Build(acCounts, acValues);
+	}
+
+	// writes entropy coded bits, stuffing a zero byte after every 0xff
+	struct BitWriter
+	{
+		vector<unsigned char> *out;
+		uint32_t bits;
+		int count;
+
+		explicit BitWriter(vector<unsigned char> *out) : out(out), bits(0), count(0)
+		{}
+
+		void Put(unsigned code, int length)
+		{
+			bits = (bits << length) | (code & ((1u << length) - 1));
+			count += length;
+			while (count >= 8) {
+				unsigned char byte = (unsigned char)(bits >> (count - 8));
+				out->push_back(byte);
+				if (byte == 0xff) out->push_back(0);
+				count -= 8;
+			}
+			bits &= (1u << count) - 1;
+		}
+
+		// pads the last byte with ones, as required before a marker
+		void Flush()
+		{
+			if (count > 0) Put(0x7f, 8 - count);
+		}
+	};
+
+	// one pass of the scaled AAN forward DCT over 8 values step apart
+	void Dct8(float *d, int step)
+	{
+		float tmp0 = d[0] + d[7 * step], tmp7 = d[0] - d[7 * step];
+		float tmp1 = d[step] + d[6 * step], tmp6 = d[step] - d[6 * step];
+		float tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+		float tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+		float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+		float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+		d[0] = tmp10 + tmp11;
+		d[4 * step] = tmp10 - tmp11;
+		float z1 = (tmp12 + tmp13) * 0.707106781f;
+		d[2 * step] = tmp13 + z1;
+		d[6 * step] = tmp13 - z1;
+
+		tmp10 = tmp4 + tmp5;
+		tmp11 = tmp5 + tmp6;
+		tmp12 = tmp6 + tmp7;
+		float z5 = (tmp10 - tmp12) * 0.382683433f;
+		float z2 = tmp10 * 0.541196100f + z5;
+		float z4 = tmp12 * 1.306562965f + z5;
+		float z3 = tmp11 * 0.707106781f;
+		float z11 = tmp7 + z3, z13 = tmp7 - z3;
+		d[5 * step] = z13 + z2;
+		d[3 * step] = z13 - z2;
+		d[step] = z11 + z4;
+		d[7 * step] = z11 - z4;
+	}
+
+	// the size category of a coefficient and the bits that follow it
+	void Magnitude(int value, unsigned *bits, int *length)
+	{
+		int magnitude = value < 0 ? -value : value;
+		int n = 0;
+		while (magnitude >> n) n++;
+		*length = n;
+		*bits = unsigned(value < 0 ? value + (1 << n) - 1 : value);
+	}
+
+	void EncodeBlock(float *block, const JpegComponent &component, int *dc, BitWriter *writer)
+	{
+		for (int row = 0; row < 8; row++)
+			Dct8(block + row * 8, 1);
+		for (int column = 0; column < 8; column++)
+			Dct8(block + column, 8);
+
+		int coefficients[64];
+		for (int k = 0; k < 64; k++) {
+			float value = block[ZIGZAG[k]] * component.scale[ZIGZAG[k]];
+			coefficients[k] = int(value < 0.f ? value - 0.5f : value + 0.5f);
+		}
+
+		unsigned bits;
+		int length;
+		Magnitude(coefficients[0] - *dc, &bits, &length);
+		*dc = coefficients[0];
+		writer->Put(component.dc.codes[length].code, component.dc.codes[length].length);
+		if (length > 0) writer->Put(bits, length);
+
+		int zeros = 0;
+		for (int k = 1; k < 64; k++) {
+			if (coefficients[k] == 0) {
+				zeros++;
+				continue;
+			}
+			// runs of sixteen zeros have their own code
+			for (; zeros >= 16; zeros -= 16)
+				writer->Put(component.ac.codes[0xf0].code, component.ac.codes[0xf0].length);
+			Magnitude(coefficients[k], &bits, &length);
+			const HuffmanCode &code = component.ac.codes[(zeros << 4) | length];
+			writer->Put(code.code, code.length);
+			writer->Put(bits, length);
+			zeros = 0;
+		}
+		if (zeros > 0)
+			writer->Put(component.ac.codes[0].code, component.ac.codes[0].length);
+	}
+
+	void PutHuffmanTable(vector<unsigned char> *out, int id, const unsigned char *counts,
+		const unsigned char *values)
+	{
+		out->push_back((unsigned char)id);
+		out->insert(out->end(), counts, counts + 16);
+		int total = 0;
+		for (int i = 0; i < 16; i++) total += counts[i];
+		out->insert(out->end(), values, values + total);
+	}
+
+	bool EncodeJpeg(int width, int height, const SourceRows &rows, int components,
+		const WriteOptions &options, vector<vector<unsigned char>> *pieces, int *bandCount)
+	{
+		if (width > 65535 || height > 65535) return false;
+		bool colour = components >= 3;
+		int channels = colour ? 3 : 1;
+
+		JpegComponent luma, chroma;
+		BuildComponent(&luma, LUMA_QUANT, options.jpegQuality, LUMA_DC_COUNTS, LUMA_AC_COUNTS,
+			LUMA_AC_VALUES);
+		BuildComponent(&chroma, CHROMA_QUANT, options.jpegQuality, CHROMA_DC_COUNTS,
+			CHROMA_AC_COUNTS, CHROMA_AC_VALUES);
+
+		// bands are whole rows of blocks, and the restart interval that
+		// separates them is counted in blocks and limited to 16 bits
+		int blockColumns = (width + 7) / 8;
+		int blockRows = (height + 7) / 8;
+		int bands = BandCount(blockRows, size_t(width) * components * 8, options.pool);
+		int bandRows = (blockRows + bands - 1) / bands;
+		if (size_t(bandRows) * blockColumns > 65535) {
+			bandRows = blockRows;
+			bands = 1;
+		}
+		bands = (blockRows + bandRows - 1) / bandRows;
+		*bandCount = bands;
+
+		vector<unsigned char> header;
+		const unsigned char jfif[] = { 0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0,
+			0, 1, 0, 1, 0, 0 };
+		header.insert(header.end(), jfif, jfif + sizeof(jfif));
+
+		Put16(&header, 0xffdb);
+		Put16(&header, colour ? 2 + 2 * 65 : 2 + 65);
+		header.push_back(0);
+		header.insert(header.end(), luma.quant, luma.quant + 64);
+		if (colour) {
+			header.push_back(1);
+			header.insert(header.end(), chroma.quant, chroma.quant + 64);
+		}
+
+		Put16(&header, 0xffc0);
+		Put16(&header, 8 + 3 * channels);
+		header.push_back(8);
+		Put16(&header, unsigned(height));
+		Put16(&header, unsigned(width));
+		header.push_back((unsigned char)channels);
+		for (int c = 0; c < channels; c++) {
+			header.push_back((unsigned char)(c + 1));
+			header.push_back(0x11);
+			header.push_back(c == 0 ? 0 : 1);
+		}
+
+		Put16(&header, 0xffc4);
+		Put16(&header, colour ? 2 + 4 * 17 + 2 * 12 + 2 * 162 : 2 + 2 * 17 + 12 + 162);
+		PutHuffmanTable(&header, 0x00, LUMA_DC_COUNTS, DC_VALUES);
+		PutHuffmanTable(&header, 0x10, LUMA_AC_COUNTS, LUMA_AC_VALUES);
+		if (colour) {
+			PutHuffmanTable(&header, 0x01, CHROMA_DC_COUNTS, DC_VALUES);
+			PutHuffmanTable(&header, 0x11, CHROMA_AC_COUNTS, CHROMA_AC_VALUES);
+		}
+
+		if (bands > 1) {
+			Put16(&header, 0xffdd);
+			Put16(&header, 4);
+			Put16(&header, unsigned(bandRows * blockColumns));
+		}
+
+		Put16(&header, 0xffda);
+		Put16(&header, 6 + 2 * channels);
+		header.push_back((unsigned char)channels);
+		for (int c = 0; c < channels; c++) {
+			header.push_back((unsigned char)(c + 1));
+			header.push_back(c == 0 ? 0x00 : 0x11);
+		}
+		header.push_back(0);
+		header.push_back(63);
+		header.push_back(0);
+		pieces->push_back(header);
+
+		// each band starts with fresh DC predictions after its restart marker
+		size_t first = pieces->size();
+		pieces->resize(first + bands);
+		RunBands(options.pool, bands, [&](int band) {
+			vector<unsigned char> &out = (*pieces)[first + band];
+			BitWriter writer(&out);
+			int dc[3] = { 0, 0, 0 };
+			float blocks[3][64];
+			int by1 = min(blockRows, (band + 1) * bandRows);
+			for (int by = band * bandRows; by < by1; by++) {
+				for (int bx = 0; bx < blockColumns; bx++) {
+					// blocks over the right and bottom edges repeat the last pixels
+					for (int y = 0; y < 8; y++) {
+						const unsigned char *row = rows.Row(min(by * 8 + y, height - 1));
+						for (int x = 0; x < 8; x++) {
+							const unsigned char *p = row + min(bx * 8 + x, width - 1) * components;
+							int i = y * 8 + x;
+							if (!colour) {
+								blocks[0][i] = p[0] - 128.f;
+								continue;
+							}
+							float r = p[0], g = p[1], b = p[2];
+							blocks[0][i] = 0.299f * r + 0.587f * g + 0.114f * b - 128.f;
+							blocks[1][i] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+							blocks[2][i] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+						}
+					}
+					for (int c = 0; c < channels; c++)
+						EncodeBlock(blocks[c], c == 0 ? luma : chroma, &dc[c], &writer);
+				}
+			}
+			writer.Flush();
+			if (band + 1 < bands) {
+				out.push_back(0xff);
+				out.push_back((unsigned char)(0xd0 + band % 8));
+			}
+		});
+
+		vector<unsigned char> end;
+		Put16(&end, 0xffd9);
+		pieces->push_back(end);
+		return true;
+	}
+
+	// ----------------------------------------------------------------------
+	// QOI, PPM and PFM
+
+	bool EncodeQoi(int width, int height, const SourceRows &rows, int components,
+		vector<unsigned char> *out)
+	{
+		// grey images are expanded, as QOI only stores RGB and RGBA
+		int channels = components == 2 || components == 4 ? 4 : 3;
+		PutText(out, "qoif");
+		Put32(out, uint32_t(width));
+		Put32(out, uint32_t(height));
+		out->push_back((unsigned char)channels);
+		out->push_back(0);
+
+		unsigned char index[64][4];
+		memset(index, 0, sizeof(index));
+		unsigned char previous[4] = { 0, 0, 0, 255 };
+		int run = 0;
+		for (int y = 0; y < height; y++) {
+			const unsigned char *row = rows.Row(y);
+			for (int x = 0; x < width; x++) {
+				const unsigned char *p = row + x * components;
+				unsigned char pixel[4];
+				if (components >= 3) {
+					pixel[0] = p[0];
+					pixel[1] = p[1];
+					pixel[2] = p[2];
+				}
+				else
+					pixel[0] = pixel[1] = pixel[2] = p[0];
+				pixel[3] = channels == 4 ? p[components - 1] : 255;
+
+				if (memcmp(pixel, previous, 4) == 0) {
+					if (++run == 62) {
+						out->push_back((unsigned char)(0xc0 | (run - 1)));
+						run = 0;
+					}
+					continue;
+				}
+				if (run > 0) {
+					out->push_back((unsigned char)(0xc0 | (run - 1)));
+					run = 0;
+				}
+
+				int slot = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+				if (memcmp(index[slot], pixel, 4) == 0)
+					out->push_back((unsigned char)slot);
+				else {
+					memcpy(index[slot], pixel, 4);
+					if (pixel[3] == previous[3]) {
+						signed char dr = (signed char)(pixel[0] - previous[0]);
+						signed char dg = (signed char)(pixel[1] - previous[1]);
+						signed char db = (signed char)(pixel[2] - previous[2]);
+						int drg = dr - dg, dbg = db - dg;
+						if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+							out->push_back((unsigned char)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+						else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+							out->push_back((unsigned char)(0x80 | (dg + 32)));
+							out->push_back((unsigned char)((drg + 8) << 4 | (dbg + 8)));
+						}
+						else {
+							out->push_back(0xfe);
+							out->insert(out->end(), pixel, pixel + 3);
+						}
+					}
+					else {
+						out->push_back(0xff);
+						out->insert(out->end(), pixel, pixel + 4);
+					}
+				}
+				memcpy(previous, pixel, 4);
+			}
+		}
+		if (run > 0) out->push_back((unsigned char)(0xc0 | (run - 1)));
+		const unsigned char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+		out->insert(out->end(), padding, padding + 8);
+		return true;
+	}
+
+	// alpha is dropped, as neither format has it
+	bool EncodePpm(int width, int height, const SourceRows &rows, int components, bool floats,
+		vector<unsigned char> *out)
+	{
+		int channels = components >= 3 ? 3 : 1;
+		char header[64];
+		if (floats) {
+			// PFM is little-endian when its scale is negative
+			snprintf(header, sizeof(header), "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf",
+				width, height);
+		}
+		else
+			snprintf(header, sizeof(header), "%s\n%d %d\n255\n", channels == 3 ? "P6" : "P5", width, height);
+		PutText(out, header);
+
+		size_t start = out->size();
+		size_t rowBytes = size_t(width) * channels * (floats ? sizeof(float) : 1);
+		out->resize(start + rowBytes * height);
+		for (int y = 0; y < height; y++) {
+			// PFM rows run bottom to top
+			const unsigned char *row = rows.Row(floats ? height - 1 - y : y);
+			unsigned char *bytes = out->data() + start + rowBytes * y;
+			for (int x = 0; x < width; x++) {
+				for (int c = 0; c < channels; c++) {
+					unsigned char value = row[x * components + c];
+					if (!floats) {
+						*bytes++ = value;
+						continue;
+					}
+					float scaled = value / 255.f;
+					uint32_t word;
+					memcpy(&word, &scaled, sizeof(word));
+					for (int i = 0; i < 4; i++)
+						*bytes++ = (unsigned char)(word >> (8 * i));
+				}
+			}
+		}
+		return true;
+	}
+}
+
+bool ParseImageFormat(const string &name, ImageFormat *format)
+{
+	if (name == "png") *format = FORMAT_PNG;
+	else if (name == "qoi") *format = FORMAT_QOI;
+	else if (name == "ppm") *format = FORMAT_PPM;
+	else if (name == "pfm") *format = FORMAT_PFM;
+	else if (name == "jpg" || name == "jpeg") *format = FORMAT_JPEG;
+	else return false;
+	return true;
+}
+
+const char *FormatExtension(ImageFormat format)
+{
+	switch (format) {
+	case FORMAT_QOI: return "qoi";
+	case FORMAT_PPM: return "ppm";
+	case FORMAT_PFM: return "pfm";
+	case FORMAT_JPEG: return "jpg";
+	default: return "png";
+	}
+}
+
+bool ParsePngFilter(const string &name, PngFilter *filter)
+{
+	static const char *names[] = { "none", "sub", "up", "average", "paeth", "adaptive" };
+	for (int i = 0; i <= PNG_FILTER_ADAPTIVE; i++) {
+		if (name == names[i]) {
+			*filter = PngFilter(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool WriteImage(const string &path, int width, int height, const unsigned char *data,
+	int components, int stride, const WriteOptions &options, WriteStats *stats)
+{
+	TRACE_SCOPE("WriteImage");
+	if (width <= 0 || height <= 0 || components < 1 || components > 4 || !data) return false;
+	auto start = chrono::steady_clock::now();
+	SourceRows rows;
+	rows.data = data;
+	rows.stride = stride != 0 ? stride : ptrdiff_t(width) * components;
+
+	// PNG and JPEG are encoded in pieces by band, the others in one buffer
+	vector<vector<unsigned char>> pieces;
+	int bands = 1;
+	bool encoded = false;
+	switch (options.format) {
+	case FORMAT_PNG:
+		encoded = EncodePng(width, height, rows, components, options, &pieces, &bands);
+		break;
+	case FORMAT_JPEG:
+		encoded = EncodeJpeg(width, height, rows, components, options, &pieces, &bands);
+		break;
+	case FORMAT_QOI:
+		pieces.resize(1);
+		encoded = EncodeQoi(width, height, rows, components, &pieces[0]);
+		break;
+	case FORMAT_PPM:
+	case FORMAT_PFM:
+		pieces.resize(1);
+		encoded = EncodePpm(width, height, rows, components, options.format == FORMAT_PFM, &pieces[0]);
+		break;
+	}
+	if (!encoded) return false;
+	double encodeSeconds = Seconds(start);
+
+	auto writeStart = chrono::steady_clock::now();
+	size_t fileBytes = 0;
+	for (const vector<unsigned char> &piece : pieces)
+		fileBytes += piece.size();
+	if (!WriteFile(path, pieces)) return false;
+
+	if (stats) {
+		stats->format = options.format;
+		stats->imageBytes = size_t(width) * height * components;
+		stats->fileBytes = fileBytes;
+		stats->bands = bands;
+		stats->encodeSeconds = encodeSeconds;
+		stats->writeSeconds = Seconds(writeStart);
+	}
+	return true;
+}
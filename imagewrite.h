@@ -0,0 +1,82 @@
+// ==========================================================================
+// Encoding and writing images in several file formats
+//
+// PNG files are encoded in bands of rows on a work pool: each band is
+// filtered and deflated on its own, primed with the last 32 KB of the band
+// before it so the compression ratio barely suffers, and ends on a byte
+// boundary with a sync flush, so the bands join into one zlib stream whose
+// checksum is combined from theirs. JPEG files are split the same way with
+// restart markers, which reset the entropy coder at every band. QOI, PPM and
+// PFM have no compression worth spreading over threads and are written
+// directly; they trade size for speed when files are only an intermediate.
+// ==========================================================================
+#ifndef IMAGEWRITE_H
+#define IMAGEWRITE_H
+
+#include <cstddef>
+#include <string>
+
+class WorkPool;
+
+enum ImageFormat
+{
+	FORMAT_PNG,
+	FORMAT_QOI,
+	FORMAT_PPM,		// binary PPM, or PGM for grey images
+	FORMAT_PFM,		// 32-bit float PFM, colours scaled to [0, 1]
+	FORMAT_JPEG		// baseline JPEG without chroma subsampling
+};
+
+// PNG row filters; adaptive picks the filter giving the smallest sum of
+// absolute differences for each row, as libpng does
+enum PngFilter
+{
+	PNG_FILTER_NONE,
+	PNG_FILTER_SUB,
+	PNG_FILTER_UP,
+	PNG_FILTER_AVERAGE,
+	PNG_FILTER_PAETH,
+	PNG_FILTER_ADAPTIVE
+};
+
+struct WriteOptions
+{
+	ImageFormat format;
+	int pngLevel;			// zlib compression level, 0 (stored) to 9
+	PngFilter pngFilter;
+	int jpegQuality;		// 1 to 100
+	WorkPool *pool;			// encodes bands in parallel if not null
+
+	WriteOptions() : format(FORMAT_PNG), pngLevel(6), pngFilter(PNG_FILTER_ADAPTIVE),
+		jpegQuality(90), pool(nullptr)
+	{}
+};
+
+struct WriteStats
+{
+	ImageFormat format;
+	size_t imageBytes;		// 8-bit pixels encoded
+	size_t fileBytes;
+	int bands;				// encoded in parallel
+	double encodeSeconds;
+	double writeSeconds;	// writing the encoded file
+
+	WriteStats() : format(FORMAT_PNG), imageBytes(0), fileBytes(0), bands(0),
+		encodeSeconds(0.0), writeSeconds(0.0)
+	{}
+};
+
+// parses "png", "qoi", "ppm", "pfm" or "jpg" (also "jpeg")
+bool ParseImageFormat(const std::string &name, ImageFormat *format);
+const char *FormatExtension(ImageFormat format);
+
+// parses "none", "sub", "up", "average", "paeth" or "adaptive"
+bool ParsePngFilter(const std::string &name, PngFilter *filter);
+
+// writes rows of 8-bit pixels with 1 to 4 components to a file in the format
+// of the options; a negative stride writes the rows bottom-up, zero means
+// tightly packed rows
+bool WriteImage(const std::string &path, int width, int height, const unsigned char *data,
+	int components, int stride, const WriteOptions &options, WriteStats *stats = nullptr);
+
+#endif
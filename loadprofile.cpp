@@ -0,0 +1,74 @@
+// ==========================================================================
+// Profiles of image loads, phase by phase
+// ==========================================================================
+
+#include "loadprofile.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+void PrintRow(const LoadProfile &profile, const string &size)
+{
+	double total = profile.TotalSeconds();
+	char row[160];
+	snprintf(row, sizeof(row), "%-16s %11s %9.1f %8.2f %9.2f %8.2f %9.2f %9.2f %8.1f",
+		profile.path.c_str(), size.c_str(), profile.fileBytes / 1024.0, profile.readSeconds * 1000.0,
+		profile.decodeSeconds * 1000.0, profile.flipSeconds * 1000.0, profile.uploadSeconds * 1000.0,
+		total * 1000.0, total > 0.0 ? profile.Megapixels() / total : 0.0);
+	cout << row << endl;
+}
+
+}
+
+void LoadProfiler::Record(const LoadProfile &profile)
+{
+	lock_guard<mutex> lock(profilesMutex);
+	profiles.push_back(profile);
+}
+
+void LoadProfiler::Clear()
+{
+	lock_guard<mutex> lock(profilesMutex);
+	profiles.clear();
+}
+
+vector<LoadProfile> LoadProfiler::Profiles() const
+{
+	lock_guard<mutex> lock(profilesMutex);
+	return profiles;
+}
+
+LoadProfile LoadProfiler::Total() const
+{
+	lock_guard<mutex> lock(profilesMutex);
+	LoadProfile total;
+	total.path = "total";
+	for (const LoadProfile &profile : profiles) {
+		total.fileBytes += profile.fileBytes;
+		total.readSeconds += profile.readSeconds;
+		total.decodeSeconds += profile.decodeSeconds;
+		total.flipSeconds += profile.flipSeconds;
+		total.uploadSeconds += profile.uploadSeconds;
+		total.pixels += profile.pixels;
+	}
+	return total;
+}
+
+void LoadProfiler::PrintTable() const
+{
+	char header[160];
+	snprintf(header, sizeof(header), "%-16s %11s %9s %8s %9s %8s %9s %9s %8s", "image", "size",
+		"file KB", "read ms", "decode ms", "flip ms", "upload ms", "total ms", "MP/s");
+	cout << header << endl;
+	for (const LoadProfile &profile : Profiles()) {
+		PrintRow(profile, to_string(profile.width) + "x" + to_string(profile.height));
+	}
+	LoadProfile total = Total();
+	char size[32];
+	snprintf(size, sizeof(size), "%.2f MP", total.Megapixels());
+	PrintRow(total, size);
+}
@@ -0,0 +1,38 @@
+// ==========================================================================
+// Profiles of image loads, phase by phase
+//
+// Loading an image to the screen reads the file, decodes it, flips its rows
+// to the order OpenGL expects and uploads it into a texture. The profiler
+// collects the time each of these took for every image loaded, with the
+// bytes read and pixels decoded, so a slow switch between images can be
+// pinned on the disk, the decoder, the flip or the upload. Profiles may be
+// recorded from any thread.
+// ==========================================================================
+#ifndef LOADPROFILE_H
+#define LOADPROFILE_H
+
+#include <mutex>
+#include <vector>
+
+#include "imagecache.h"
+
+class LoadProfiler
+{
+public:
+	void Record(const LoadProfile &profile);
+	void Clear();
+
+	std::vector<LoadProfile> Profiles() const;
+
+	// the sum of every profile, named "total"
+	LoadProfile Total() const;
+
+	// prints a row of milliseconds per phase for each image and their sum
+	void PrintTable() const;
+
+private:
+	mutable std::mutex profilesMutex;
+	std::vector<LoadProfile> profiles;
+};
+
+#endif
@@ -0,0 +1,48 @@
+// ==========================================================================
+// Read-only memory-mapped files
+// ==========================================================================
+
+#include "mappedfile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+MappedFile::MappedFile() : data(nullptr), size(0)
+{}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const string &path, bool willNeed)
+{
+	Close();
+	int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) return false;
+
+	// the mapping keeps the file alive, so the descriptor is closed at once
+	struct stat info;
+	void *mapping = MAP_FAILED;
+	if (fstat(descriptor, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+		mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+	close(descriptor);
+	if (mapping == MAP_FAILED) return false;
+
+	data = static_cast<unsigned char *>(mapping);
+	size = size_t(info.st_size);
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	if (willNeed) madvise(mapping, size, MADV_WILLNEED);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data) munmap(data, size);
+	data = nullptr;
+	size = 0;
+}
@@ -0,0 +1,38 @@
+// ==========================================================================
+// Read-only memory-mapped files
+//
+// Image files are decoded straight from a mapping of the file rather than
+// through buffered reads, so the bytes go from the page cache to the decoder
+// without a copy into a stdio buffer and without a read call per buffer.
+// The mapping is advised as read sequentially, and optionally as needed
+// soon, which starts the kernel reading the whole file ahead of the decoder.
+// ==========================================================================
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// maps the whole file, returning false if it cannot be opened or mapped,
+	// e.g. when it is empty; willNeed asks for its pages to be read at once
+	bool Open(const std::string &path, bool willNeed = false);
+	void Close();
+
+	const unsigned char *Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	unsigned char *data;
+	size_t size;
+};
+
+#endif
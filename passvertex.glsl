@@ -0,0 +1,19 @@
+// ==========================================================================
+// Vertex program for image-space passes
+//
+// Draws a quad covering the whole render target with texture coordinates in
+// pixels, so each fragment lines up with one texel of the source image.
+// ==========================================================================
+#version 410
+
+// location indices match those used by InitializeQuad() in the main program
+layout(location = 0) in vec2 VertexPosition;
+layout(location = 2) in vec2 VertexTexture;
+
+out vec2 textureCoords;
+
+void main()
+{
+	gl_Position = vec4(VertexPosition, 0.0, 1.0);
+	textureCoords = VertexTexture;
+}
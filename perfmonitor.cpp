@@ -0,0 +1,212 @@
+// ==========================================================================
+// Rolling performance figures for the viewer
+// ==========================================================================
+
+#include "perfmonitor.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// GPU passes not run for this long belong to an old filter chain and are
+// left off the summary
+const double STALE_SECONDS = 1.0;
+
+namespace {
+
+const char *SourceName(PerfSource source)
+{
+	switch (source) {
+	case PERF_FRAME: return "frame";
+	case PERF_GPU: return "gpu";
+	case PERF_CPU: return "cpu";
+	}
+	return "unknown";
+}
+
+string Quoted(const string &text)
+{
+	string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') quoted += '\\';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+string Line(const char *format, const string &name, double a, double b)
+{
+	char line[96];
+	snprintf(line, sizeof(line), format, name.substr(0, 20).c_str(), a, b);
+	return line;
+}
+
+}
+
+// --------------------------------------------------------------------------
+// Rolling figures of one series
+
+double PerfSeries::MeanMs() const
+{
+	if (recent.empty()) return 0.0;
+	double total = 0.0;
+	for (const PerfSample &sample : recent) total += sample.ms;
+	return total / double(recent.size());
+}
+
+double PerfSeries::MaxMs() const
+{
+	double peak = 0.0;
+	for (const PerfSample &sample : recent) peak = max(peak, sample.ms);
+	return peak;
+}
+
+double PerfSeries::Throughput() const
+{
+	double ms = 0.0;
+	double megapixels = 0.0;
+	for (const PerfSample &sample : recent) {
+		ms += sample.ms;
+		megapixels += sample.megapixels;
+	}
+	return ms > 0.0 ? megapixels / (ms * 1e-3) : 0.0;
+}
+
+// --------------------------------------------------------------------------
+// Monitor
+
+PerfMonitor::PerfMonitor(size_t window, size_t logLimit)
+	: window(max<size_t>(window, 1)), logLimit(logLimit), start(chrono::steady_clock::now()),
+	samples(0), logging(false)
+{}
+
+void PerfMonitor::SetLogging(bool enabled)
+{
+	logging = enabled;
+	if (!logging) vector<PerfSample>().swap(log);
+}
+
+void PerfMonitor::Add(PerfSource source, const string &name, double ms, double megapixels)
+{
+	PerfSample sample;
+	sample.time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	sample.source = source;
+	sample.name = name;
+	sample.ms = ms;
+	sample.megapixels = megapixels;
+	sample.sequence = samples++;
+	if (logging && log.size() < logLimit) log.push_back(sample);
+
+	PerfSeries *entry = nullptr;
+	for (PerfSeries &existing : series) {
+		if (existing.source == source && existing.name == name) entry = &existing;
+	}
+	if (!entry) {
+		series.push_back(PerfSeries());
+		entry = &series.back();
+		entry->source = source;
+		entry->name = name;
+	}
+	entry->recent.push_back(sample);
+	if (entry->recent.size() > window) entry->recent.pop_front();
+	entry->count++;
+}
+
+const PerfSeries *PerfMonitor::Find(PerfSource source, const string &name) const
+{
+	for (const PerfSeries &entry : series) {
+		if (entry.source == source && entry.name == name) return &entry;
+	}
+	return nullptr;
+}
+
+vector<string> PerfMonitor::Summary() const
+{
+	double now = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	vector<string> lines;
+	for (const PerfSeries &entry : series) {
+		if (entry.source != PERF_FRAME) continue;
+		double mean = entry.MeanMs();
+		if (entry.name == "frame") {
+			double rate = mean > 0.0 ? 1000.0 / mean : 0.0;
+			lines.push_back(Line("%-12s %7.2f ms %6.1f fps", entry.name, mean, rate));
+		}
+		else
+			lines.push_back(Line("%-12s %7.2f ms max %6.2f", entry.name, mean, entry.MaxMs()));
+	}
+
+	// passes are listed in the order the latest frame ran them
+	vector<const PerfSeries *> passes;
+	for (const PerfSeries &entry : series) {
+		if (entry.source == PERF_GPU && now - entry.recent.back().time <= STALE_SECONDS)
+			passes.push_back(&entry);
+	}
+	sort(passes.begin(), passes.end(), [](const PerfSeries *a, const PerfSeries *b) {
+		return a->recent.back().sequence < b->recent.back().sequence;
+	});
+	vector<const PerfSeries *> work;
+	for (const PerfSeries &entry : series) {
+		if (entry.source == PERF_CPU) work.push_back(&entry);
+	}
+
+	static const PerfSource sections[] = { PERF_GPU, PERF_CPU };
+	for (PerfSource source : sections) {
+		bool header = false;
+		for (const PerfSeries *listed : source == PERF_GPU ? passes : work) {
+			const PerfSeries &entry = *listed;
+			if (!header) {
+				char line[96];
+				snprintf(line, sizeof(line), "%-20s %8s %8s", source == PERF_GPU ? "GPU pass" : "CPU work",
+					"ms", "MP/s");
+				lines.push_back(line);
+				header = true;
+			}
+			double throughput = entry.Throughput();
+			string line = Line("%-20s %8.3f %8.1f", entry.name, entry.MeanMs(), throughput);
+			if (throughput == 0.0) line.resize(29);
+			lines.push_back(line);
+		}
+	}
+	return lines;
+}
+
+bool PerfMonitor::Dump(const string &path) const
+{
+	ofstream out(path.c_str());
+	if (!out) {
+		cout << "Unable to write performance samples to " << path << endl;
+		return false;
+	}
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+
+	if (!json) {
+		out << "time_s,source,name,ms,megapixels\n";
+		for (const PerfSample &sample : log) {
+			out << sample.time << ',' << SourceName(sample.source) << ',' << Quoted(sample.name)
+				<< ',' << sample.ms << ',' << sample.megapixels << '\n';
+		}
+		return bool(out);
+	}
+
+	// the samples, then the rolling figures each series ended with
+	out << "{\n\t\"samples\": [";
+	for (size_t i = 0; i < log.size(); i++) {
+		const PerfSample &sample = log[i];
+		out << (i ? ",\n\t\t" : "\n\t\t") << "{\"time_s\": " << sample.time << ", \"source\": \""
+			<< SourceName(sample.source) << "\", \"name\": " << Quoted(sample.name) << ", \"ms\": "
+			<< sample.ms << ", \"megapixels\": " << sample.megapixels << "}";
+	}
+	out << "\n\t],\n\t\"series\": [";
+	for (size_t i = 0; i < series.size(); i++) {
+		const PerfSeries &entry = series[i];
+		out << (i ? ",\n\t\t" : "\n\t\t") << "{\"source\": \"" << SourceName(entry.source)
+			<< "\", \"name\": " << Quoted(entry.name) << ", \"count\": " << entry.count
+			<< ", \"mean_ms\": " << entry.MeanMs() << ", \"max_ms\": " << entry.MaxMs()
+			<< ", \"megapixels_per_second\": " << entry.Throughput() << "}";
+	}
+	out << "\n\t]\n}\n";
+	return bool(out);
+}
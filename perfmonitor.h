@@ -0,0 +1,109 @@
+// ==========================================================================
+// Rolling performance figures for the viewer
+//
+// Frame times, GPU passes and CPU work such as decodes, uploads and input
+// handling are recorded as samples under a name. Each name keeps the last
+// few samples for a rolling average shown on the HUD. While logging is on,
+// every sample is also kept with the time it was taken, so a run can be
+// dumped as CSV or JSON and analysed offline; otherwise only the rolling
+// window is kept. Samples are only recorded on the main thread.
+// ==========================================================================
+#ifndef PERFMONITOR_H
+#define PERFMONITOR_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+enum PerfSource
+{
+	PERF_FRAME,		// time between frames on screen
+	PERF_GPU,		// a render pass, from timer queries
+	PERF_CPU		// work on the CPU
+};
+
+struct PerfSample
+{
+	double time;		// seconds since the monitor was created
+	PerfSource source;
+	std::string name;
+	double ms;
+	double megapixels;	// zero if the work has no pixel count
+	size_t sequence;	// order the samples were recorded in
+
+	PerfSample() : time(0.0), source(PERF_CPU), ms(0.0), megapixels(0.0), sequence(0)
+	{}
+};
+
+// rolling figures over the last samples of one name
+struct PerfSeries
+{
+	PerfSource source;
+	std::string name;
+	std::deque<PerfSample> recent;
+	size_t count;		// samples ever recorded
+
+	PerfSeries() : source(PERF_CPU), count(0)
+	{}
+
+	double MeanMs() const;
+	double MaxMs() const;
+	// megapixels per second over the recent samples, or zero
+	double Throughput() const;
+};
+
+class PerfMonitor
+{
+public:
+	// window is the number of samples the rolling figures cover; the log
+	// stops growing after logLimit samples
+	explicit PerfMonitor(size_t window = 60, size_t logLimit = 1u << 20);
+
+	void Add(PerfSource source, const std::string &name, double ms, double megapixels = 0.0);
+
+	// keeps every sample for Dump(); off by default, and turning it off
+	// frees the log
+	void SetLogging(bool enabled);
+
+	const std::vector<PerfSeries> &Series() const { return series; }
+	const PerfSeries *Find(PerfSource source, const std::string &name) const;
+
+	// a few lines of fixed-width text summarising every series
+	std::vector<std::string> Summary() const;
+
+	// writes the log as JSON if the path ends in .json and as CSV otherwise
+	bool Dump(const std::string &path) const;
+	size_t Logged() const { return log.size(); }
+
+private:
+	size_t window;
+	size_t logLimit;
+	std::chrono::steady_clock::time_point start;
+	size_t samples;
+	bool logging;
+	std::vector<PerfSeries> series;
+	std::vector<PerfSample> log;
+};
+
+// records the time until it goes out of scope as a CPU sample
+class ScopedCpuTimer
+{
+public:
+	ScopedCpuTimer(PerfMonitor *monitor, const char *name)
+		: monitor(monitor), name(name), start(std::chrono::steady_clock::now())
+	{}
+	~ScopedCpuTimer()
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (monitor) monitor->Add(PERF_CPU, name, elapsed.count());
+	}
+
+private:
+	PerfMonitor *monitor;
+	const char *name;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
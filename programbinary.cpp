@@ -0,0 +1,223 @@
+// ==========================================================================
+// On-disk cache of linked shader program binaries
+// ==========================================================================
+
+#include "programbinary.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+using namespace std;
+
+namespace
+{
+	const uint32_t BINARY_MAGIC = 0x42504c47;	// "GLPB"
+	const uint32_t BINARY_VERSION = 2;
+	const char BINARY_EXTENSION[] = ".bin";
+
+	// leads every file, followed by the driver string and the binary; the
+	// driver string is kept in full so that a file is never handed to a
+	// driver other than the one that wrote it
+	struct BinaryHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t format;
+		uint32_t driverLength;
+		uint32_t binaryLength;
+		uint32_t padding;
+		uint64_t sourceHash;	// of both sources, to spot edited shaders
+	};
+
+	// 64-bit FNV-1a
+	uint64_t Hash(const string &text, uint64_t hash = 14695981039346656037ull)
+	{
+		for (unsigned char c : text) {
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	string GLString(GLenum name)
+	{
+		const GLubyte *value = glGetString(name);
+		return value ? reinterpret_cast<const char *>(value) : "";
+	}
+
+	double Seconds(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
+	// reads the header and driver string of a file, returning false if it
+	// is not a whole binary file of this layout; the size is checked before
+	// anything is allocated, so a truncated or corrupt file is just a miss
+	bool ReadHeader(ifstream &input, BinaryHeader *header, string *driver)
+	{
+		if (!input) return false;
+		input.seekg(0, ios::end);
+		streamoff size = input.tellg();
+		input.seekg(0, ios::beg);
+		if (size < streamoff(sizeof(*header))
+			|| !input.read(reinterpret_cast<char *>(header), sizeof(*header))
+			|| header->magic != BINARY_MAGIC || header->version != BINARY_VERSION
+			|| size != streamoff(sizeof(*header)) + header->driverLength + header->binaryLength)
+			return false;
+		driver->assign(header->driverLength, '\0');
+		return header->driverLength == 0 || input.read(&(*driver)[0], driver->size());
+	}
+}
+
+ProgramBinaryCache::ProgramBinaryCache() : enabled(false)
+{}
+
+bool ProgramBinaryCache::Initialize(const string &directory)
+{
+	enabled = false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (CheckGLErrors() || formats <= 0) {
+		cout << "The driver cannot save program binaries, shaders will be compiled on every launch" << endl;
+		return false;
+	}
+	if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+		cout << "Unable to create shader cache directory " << directory << endl;
+		return false;
+	}
+	this->directory = directory;
+	driver = GLString(GL_VENDOR) + "\n" + GLString(GL_RENDERER) + "\n" + GLString(GL_VERSION);
+	enabled = true;
+
+	// each program has one file, so the cache only outgrows the programs in
+	// use when the driver changes; the files of other drivers are deleted
+	DIR *entries = opendir(directory.c_str());
+	if (!entries) return true;
+	size_t extension = sizeof(BINARY_EXTENSION) - 1;
+	while (dirent *entry = readdir(entries)) {
+		string name = entry->d_name;
+		if (name.size() <= extension || name.compare(name.size() - extension, extension, BINARY_EXTENSION) != 0)
+			continue;
+		string path = directory + "/" + name;
+		ifstream input(path.c_str(), ios::binary);
+		BinaryHeader header;
+		string fileDriver;
+		bool current = ReadHeader(input, &header, &fileDriver) && fileDriver == driver;
+		input.close();
+		if (!current && remove(path.c_str()) == 0) stats.removed++;
+	}
+	closedir(entries);
+	return true;
+}
+
+string ProgramBinaryCache::Path(const string &name) const
+{
+	char file[32];
+	snprintf(file, sizeof(file), "%016llx", (unsigned long long)Hash(name));
+	return directory + "/" + file + BINARY_EXTENSION;
+}
+
+uint64_t ProgramBinaryCache::SourceHash(const string &vertexSource, const string &fragmentSource) const
+{
+	// the separator keeps moving text from one source to the other from
+	// giving the same hash
+	return Hash(string(1, '\0') + fragmentSource, Hash(vertexSource));
+}
+
+GLuint ProgramBinaryCache::Load(const string &name, const string &vertexSource, const string &fragmentSource)
+{
+	if (!enabled) return 0;
+	TRACE_SCOPE("LoadProgramBinary");
+	auto start = chrono::steady_clock::now();
+
+	ifstream input(Path(name).c_str(), ios::binary);
+	BinaryHeader header;
+	string fileDriver;
+	if (!ReadHeader(input, &header, &fileDriver) || fileDriver != driver
+		|| header.sourceHash != SourceHash(vertexSource, fragmentSource)) {
+		stats.misses++;
+		return 0;
+	}
+	vector<char> binary(header.binaryLength);
+	if (!input.read(binary.data(), binary.size())) {
+		stats.misses++;
+		return 0;
+	}
+
+	// a driver update may keep its version string but change its binaries,
+	// in which case the program simply fails to link
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.format, binary.data(), GLsizei(binary.size()));
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked == GL_FALSE || CheckGLErrors()) {
+		glDeleteProgram(program);
+		stats.rejected++;
+		stats.loadSeconds += Seconds(start);
+		return 0;
+	}
+	stats.loads++;
+	stats.loadSeconds += Seconds(start);
+	return program;
+}
+
+void ProgramBinaryCache::Store(GLuint program, const string &name, const string &vertexSource,
+	const string &fragmentSource)
+{
+	if (!enabled || program == 0) return;
+	TRACE_SCOPE("StoreProgramBinary");
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+	vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+	if (CheckGLErrors() || length <= 0) return;
+
+	BinaryHeader header;
+	header.magic = BINARY_MAGIC;
+	header.version = BINARY_VERSION;
+	header.format = format;
+	header.driverLength = uint32_t(driver.size());
+	header.binaryLength = uint32_t(length);
+	header.padding = 0;
+	header.sourceHash = SourceHash(vertexSource, fragmentSource);
+
+	// written beside the final name and renamed over it, so that another
+	// instance starting up never reads half a file
+	string path = Path(name);
+	string partial = path + "." + to_string(getpid());
+	{
+		ofstream output(partial.c_str(), ios::binary);
+		output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		output.write(driver.data(), driver.size());
+		output.write(binary.data(), length);
+		if (!output) {
+			output.close();
+			remove(partial.c_str());
+			cout << "Unable to write program binary " << path << endl;
+			return;
+		}
+	}
+	if (rename(partial.c_str(), path.c_str()) != 0) {
+		remove(partial.c_str());
+		return;
+	}
+	stats.stores++;
+}
+
+void ProgramBinaryCache::RecordCompile(double seconds)
+{
+	stats.compiles++;
+	stats.compileSeconds += seconds;
+}
@@ -0,0 +1,79 @@
+// ==========================================================================
+// On-disk cache of linked shader program binaries
+//
+// Every program linked from source is read back with glGetProgramBinary()
+// and saved in a file named after its shader files and #define lines, so
+// each program has one file that is overwritten rather than a new one per
+// edit. The file also holds a hash of the sources and the driver's vendor,
+// renderer and version strings. The next launch restores the program with
+// glProgramBinary() instead of compiling and linking again. A binary of
+// other sources or from another driver, or one the driver refuses to load,
+// is a miss, and the program is compiled from source and saved over it.
+// ==========================================================================
+#ifndef PROGRAMBINARY_H
+#define PROGRAMBINARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "boilerplate.h"
+
+struct ProgramBinaryStats
+{
+	size_t loads;			// programs restored from a binary
+	size_t misses;			// no binary saved for the sources and driver
+	size_t removed;			// unreadable files or those of other drivers,
+							// deleted by Initialize()
+	size_t rejected;		// binaries the driver would not load
+	size_t compiles;		// programs compiled and linked from source
+	size_t stores;
+	double loadSeconds;
+	double compileSeconds;
+
+	ProgramBinaryStats() : loads(0), misses(0), removed(0), rejected(0), compiles(0), stores(0),
+		loadSeconds(0.0), compileSeconds(0.0)
+	{}
+};
+
+class ProgramBinaryCache
+{
+public:
+	ProgramBinaryCache();
+
+	// creates the directory and enables the cache, deleting unreadable files
+	// and those of other drivers or an older file layout; returns false, leaving it
+	// disabled, if the driver has no binary formats or the directory cannot
+	// be created. Needs a current OpenGL context
+	bool Initialize(const std::string &directory);
+	bool Enabled() const { return enabled; }
+
+	// name identifies the program, e.g. its shader files and #define lines;
+	// returns a linked program restored from the binary saved under it, or
+	// zero if there is none for these sources that the driver accepts
+	GLuint Load(const std::string &name, const std::string &vertexSource,
+		const std::string &fragmentSource);
+
+	// saves the binary of a program linked from these sources under name,
+	// replacing any earlier one; the program should have been linked with
+	// GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+	void Store(GLuint program, const std::string &name, const std::string &vertexSource,
+		const std::string &fragmentSource);
+
+	// counts a program compiled from source, cached or not, so that the
+	// time spent on shaders with and without the cache can be compared
+	void RecordCompile(double seconds);
+
+	const ProgramBinaryStats &Stats() const { return stats; }
+
+private:
+	std::string Path(const std::string &name) const;
+	uint64_t SourceHash(const std::string &vertexSource, const std::string &fragmentSource) const;
+
+	std::string directory;
+	std::string driver;		// vendor, renderer and version strings
+	bool enabled;
+	ProgramBinaryStats stats;
+};
+
+#endif
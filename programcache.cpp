@@ -0,0 +1,41 @@
+// ==========================================================================
+// Cache of shader programs specialized for each combination of effects
+// ==========================================================================
+
+#include "programcache.h"
+
+using namespace std;
+
+ProgramCache::ProgramCache(const string &vertexFile, const string &fragmentFile)
+	: vertexFile(vertexFile), fragmentFile(fragmentFile), lastProgram(nullptr)
+{}
+
+MyShader *ProgramCache::Get(const string &defines)
+{
+	auto it = programs.find(defines);
+	if (it == programs.end()) {
+		MyShader shader;
+		stats.compiles++;
+		if (!InitializeShaders(&shader, vertexFile, fragmentFile, defines)) {
+			stats.failures++;
+			DestroyShaders(&shader);
+			shader = MyShader();
+		}
+		it = programs.insert(make_pair(defines, shader)).first;
+	}
+
+	MyShader *program = it->second.program != 0 ? &it->second : nullptr;
+	if (program != lastProgram) stats.switches++;
+	lastProgram = program;
+	return program;
+}
+
+void ProgramCache::Destroy()
+{
+	for (auto &entry : programs) {
+		if (entry.second.program != 0)
+			DestroyShaders(&entry.second);
+	}
+	programs.clear();
+	lastProgram = nullptr;
+}
@@ -0,0 +1,51 @@
+// ==========================================================================
+// Cache of shader programs specialized for each combination of effects
+//
+// Instead of one program branching on uniforms for every fragment, each
+// combination of effects is compiled from the same sources with #define
+// lines selecting its code. Programs are compiled the first time their
+// combination is drawn and kept until the cache is destroyed.
+// ==========================================================================
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+#include "boilerplate.h"
+
+struct ProgramCacheStats
+{
+	size_t compiles;
+	size_t failures;
+	size_t switches;	// times a different program was bound than last frame
+
+	ProgramCacheStats() : compiles(0), failures(0), switches(0)
+	{}
+};
+
+class ProgramCache
+{
+public:
+	ProgramCache(const std::string &vertexFile, const std::string &fragmentFile);
+	~ProgramCache() { Destroy(); }
+
+	// returns the program built with the given #define lines, compiling it
+	// on first use; returns null if it failed to compile, without retrying
+	MyShader *Get(const std::string &defines);
+
+	void Destroy();
+
+	const ProgramCacheStats &Stats() const { return stats; }
+	size_t Size() const { return programs.size(); }
+
+private:
+	std::string vertexFile;
+	std::string fragmentFile;
+	std::unordered_map<std::string, MyShader> programs;
+	const MyShader *lastProgram;
+	ProgramCacheStats stats;
+};
+
+#endif
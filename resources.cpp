@@ -0,0 +1,109 @@
+// ==========================================================================
+// GPU resource lifetime management
+// ==========================================================================
+
+#include "resources.h"
+
+using namespace std;
+
+GpuResources::GpuResources(size_t budget, size_t maxSpare) : maxSpare(maxSpare)
+{
+	stats.budget = budget;
+}
+
+void GpuResources::SetBudget(size_t budget)
+{
+	stats.budget = budget;
+	while (stats.liveBytes > stats.budget && !spare.empty())
+		DeleteSpare();
+}
+
+MyTexture GpuResources::AcquireTexture(GLenum target, GLenum format, int width, int height)
+{
+	MyTexture texture;
+	texture.target = target;
+	texture.format = format;
+	texture.width = width;
+	texture.height = height;
+	size_t bytes = TextureBytes(texture);
+
+	for (;;) {
+		for (auto it = spare.begin(); it != spare.end(); ++it) {
+			if (it->target == target && it->format == format
+				&& it->width == width && it->height == height) {
+				texture = *it;
+				spare.erase(it);
+				stats.spareTextures = spare.size();
+				stats.liveTextures++;
+				stats.reuses++;
+				return texture;
+			}
+		}
+		if (stats.liveBytes + bytes <= stats.budget) break;
+
+		// make room, preferring to drop textures nobody is using; if nothing
+		// more can be freed, go over budget rather than fail to show the image
+		if (!spare.empty())
+			DeleteSpare();
+		else if (!onPressure || !onPressure())
+			break;
+	}
+
+	glGenTextures(1, &texture.textureID);
+	glBindTexture(target, texture.textureID);
+	glTexImage2D(target, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+
+	// Note: Only wrapping modes supported for GL_TEXTURE_RECTANGLE when defining
+	// GL_TEXTURE_WRAP are GL_CLAMP_TO_EDGE or GL_CLAMP_TO_BORDER
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(target, 0);
+
+	stats.liveBytes += bytes;
+	stats.liveTextures++;
+	stats.allocations++;
+	return texture;
+}
+
+void GpuResources::ReleaseTexture(MyTexture *texture)
+{
+	if (texture->textureID == 0) return;
+	stats.liveTextures--;
+	spare.push_back(*texture);
+	*texture = MyTexture();
+
+	// spares over budget are only dropped by the next allocation, which may
+	// be able to reuse one of them instead
+	while (spare.size() > maxSpare)
+		DeleteSpare();
+	stats.spareTextures = spare.size();
+}
+
+void GpuResources::TrackBuffer(size_t bytes)
+{
+	stats.liveBytes += bytes;
+}
+
+void GpuResources::UntrackBuffer(size_t bytes)
+{
+	stats.liveBytes -= bytes;
+}
+
+void GpuResources::Destroy()
+{
+	while (!spare.empty())
+		DeleteSpare();
+}
+
+// deletes the oldest spare texture
+void GpuResources::DeleteSpare()
+{
+	MyTexture texture = spare.front();
+	spare.pop_front();
+	stats.liveBytes -= TextureBytes(texture);
+	stats.deletions++;
+	stats.spareTextures = spare.size();
+	DestroyTexture(&texture);
+}
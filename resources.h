@@ -0,0 +1,72 @@
+// ==========================================================================
+// GPU resource lifetime management
+//
+// Textures are handed out and taken back by a single owner that keeps a few
+// released textures around, so a new image with the same size and format as
+// an old one overwrites its storage with glTexSubImage2D instead of
+// allocating. All live texture and buffer memory is counted against a
+// budget; when an allocation would exceed it, spare textures are deleted
+// first and then the pressure callback is asked to give textures back.
+// ==========================================================================
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+
+#include "boilerplate.h"
+
+struct ResourceStats
+{
+	size_t liveBytes;		// textures in use, spare textures and buffers
+	size_t budget;
+	size_t liveTextures;
+	size_t spareTextures;
+	size_t allocations;
+	size_t reuses;
+	size_t deletions;
+
+	ResourceStats() : liveBytes(0), budget(0), liveTextures(0), spareTextures(0),
+		allocations(0), reuses(0), deletions(0)
+	{}
+};
+
+class GpuResources
+{
+public:
+	// frees one texture back to the manager, returning false if it cannot
+	typedef std::function<bool()> PressureFunction;
+
+	explicit GpuResources(size_t budget, size_t maxSpare = 4);
+
+	void SetPressureCallback(PressureFunction callback) { onPressure = callback; }
+	void SetBudget(size_t budget);
+
+	// returns a texture with allocated but undefined contents, recycling a
+	// released one of the same target, format and size when possible
+	MyTexture AcquireTexture(GLenum target, GLenum format, int width, int height);
+
+	// hands a texture back; it is kept for reuse or deleted if over budget
+	void ReleaseTexture(MyTexture *texture);
+
+	// accounts for buffer objects created elsewhere
+	void TrackBuffer(size_t bytes);
+	void UntrackBuffer(size_t bytes);
+
+	// deletes every spare texture; textures still in use remain their
+	// owner's responsibility to release
+	void Destroy();
+
+	const ResourceStats &Stats() const { return stats; }
+
+private:
+	void DeleteSpare();
+
+	std::deque<MyTexture> spare;
+	size_t maxSpare;
+	PressureFunction onPressure;
+	ResourceStats stats;
+};
+
+#endif
@@ -0,0 +1,193 @@
+// ==========================================================================
+// Streaming texture upload through pixel buffer objects
+// ==========================================================================
+
+#include "textureupload.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+TextureUploader::TextureUploader()
+	: capacity(0), persistent(false), nextBuffer(0), format(0), nextRow(0)
+{
+	buffers[0] = buffers[1] = 0;
+	fences[0] = fences[1] = 0;
+	mapped[0] = mapped[1] = nullptr;
+}
+
+bool TextureUploader::Initialize(size_t bandBytes)
+{
+	persistent = HasGLExtension("GL_ARB_buffer_storage");
+	return Reserve(bandBytes);
+}
+
+void TextureUploader::Destroy()
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	for (int i = 0; i < 2; i++) {
+		if (fences[i]) {
+			glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+		if (mapped[i]) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			mapped[i] = nullptr;
+		}
+	}
+	glDeleteBuffers(2, buffers);
+	buffers[0] = buffers[1] = 0;
+	capacity = 0;
+}
+
+// (re)creates both pixel buffers with room for at least the given size
+bool TextureUploader::Reserve(size_t bytes)
+{
+	if (buffers[0] != 0 && bytes <= capacity) return true;
+
+	bool wasPersistent = persistent;
+	Destroy();
+	persistent = wasPersistent;
+	capacity = bytes;
+
+	glGenBuffers(2, buffers);
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+		if (persistent) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+			mapped[i] = static_cast<unsigned char *>(
+				glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags));
+		}
+		else {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return !CheckGLErrors();
+}
+
+bool TextureUploader::Begin(const shared_ptr<DecodedImage> &source, GLenum target,
+	const string &name, const MyTexture &reuse)
+{
+	if (!source || source->pixels == nullptr) return false;
+
+	image = source;
+	format = TextureFormat(image->components);
+	nextRow = 0;
+	start = chrono::steady_clock::now();
+
+	stats = UploadStats();
+	stats.name = name;
+	stats.width = image->width;
+	stats.height = image->height;
+	stats.bytes = image->ByteSize();
+	stats.persistent = persistent;
+
+	size_t rowBytes = size_t(image->width) * image->components;
+	if (!Reserve(max(capacity, rowBytes))) {
+		image.reset();
+		return false;
+	}
+
+	bool matches = reuse.textureID != 0 && reuse.target == target && reuse.format == format
+		&& reuse.width == image->width && reuse.height == image->height;
+	if (matches) {
+		texture = reuse;
+		return true;
+	}
+
+	// allocate storage only; the pixels arrive band by band in Step()
+	texture = MyTexture();
+	texture.target = target;
+	texture.format = format;
+	texture.width = image->width;
+	texture.height = image->height;
+	glGenTextures(1, &texture.textureID);
+	glBindTexture(target, texture.textureID);
+	glTexImage2D(target, 0, format, texture.width, texture.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(target, 0);
+	return !CheckGLErrors();
+}
+
+bool TextureUploader::Step()
+{
+	if (!image) return false;
+	stats.frames++;
+
+	// never block the render loop: if the GPU has not finished reading the
+	// buffer we want to refill, try again next frame
+	int k = nextBuffer;
+	if (fences[k]) {
+		if (glClientWaitSync(fences[k], 0, 0) == GL_TIMEOUT_EXPIRED) return false;
+		glDeleteSync(fences[k]);
+		fences[k] = 0;
+	}
+
+	auto copyStart = chrono::steady_clock::now();
+	size_t rowBytes = size_t(image->width) * image->components;
+	int rows = min(image->height - nextRow, max(1, int(capacity / rowBytes)));
+	size_t bytes = rows * rowBytes;
+	const unsigned char *source = image->pixels + nextRow * rowBytes;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[k]);
+	if (persistent) {
+		memcpy(mapped[k], source, bytes);
+	}
+	else {
+		// orphan the old contents so mapping never waits on the GPU
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+		void *destination = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (destination) memcpy(destination, source, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+
+	// rows in stb_image buffers are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(texture.target, texture.textureID);
+	glTexSubImage2D(texture.target, 0, 0, nextRow, image->width, rows, format, GL_UNSIGNED_BYTE, nullptr);
+	glBindTexture(texture.target, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	fences[k] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	nextBuffer = 1 - k;
+
+	auto now = chrono::steady_clock::now();
+	stats.copySeconds += chrono::duration<double>(now - copyStart).count();
+	stats.bands++;
+	nextRow += rows;
+	if (nextRow < image->height) return false;
+
+	stats.seconds = chrono::duration<double>(now - start).count();
+	image.reset();
+	CheckGLErrors();
+	return true;
+}
+
+MyTexture TextureUploader::Cancel()
+{
+	image.reset();
+	MyTexture abandoned = texture;
+	texture = MyTexture();
+	return abandoned;
+}
+
+bool HasGLExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		const char *extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+		if (extension && strcmp(extension, name) == 0) return true;
+	}
+	return false;
+}
@@ -0,0 +1,84 @@
+// ==========================================================================
+// Streaming texture upload through pixel buffer objects
+//
+// Decoded pixels are copied into one of two pixel unpack buffers a band of
+// rows at a time, and glTexSubImage2D sources each band from the buffer so
+// the driver can transfer it while the next frame is being rendered. Where
+// GL_ARB_buffer_storage is available the buffers stay persistently mapped;
+// otherwise each band orphans and remaps its buffer.
+// ==========================================================================
+#ifndef TEXTUREUPLOAD_H
+#define TEXTUREUPLOAD_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "boilerplate.h"
+#include "imagecache.h"
+
+struct UploadStats
+{
+	std::string name;
+	int width;
+	int height;
+	size_t bytes;
+	int bands;
+	int frames;			// number of Step() calls the upload spanned
+	double seconds;		// wall time from Begin() until the last band was issued
+	double copySeconds;	// time spent copying into buffers and issuing uploads
+	bool persistent;
+
+	UploadStats() : width(0), height(0), bytes(0), bands(0), frames(0),
+		seconds(0.0), copySeconds(0.0), persistent(false)
+	{}
+};
+
+class TextureUploader
+{
+public:
+	TextureUploader();
+
+	// creates the pixel buffers; requires a current OpenGL context
+	bool Initialize(size_t bandBytes = 8u << 20);
+	void Destroy();
+
+	// starts uploading an image; storage of the given texture is reused when
+	// its size and format already match, otherwise a new texture is created
+	bool Begin(const std::shared_ptr<DecodedImage> &image, GLenum target,
+		const std::string &name, const MyTexture &reuse = MyTexture());
+
+	// issues at most one band of rows, returning true once the whole image
+	// has been submitted and the texture may be used for drawing
+	bool Step();
+
+	// abandons the upload in progress, returning its texture for disposal
+	MyTexture Cancel();
+
+	bool Active() const { return image != nullptr; }
+	const std::string &Name() const { return stats.name; }
+	const MyTexture &Texture() const { return texture; }
+	const UploadStats &Stats() const { return stats; }
+
+private:
+	bool Reserve(size_t bytes);
+
+	GLuint buffers[2];
+	GLsync fences[2];
+	unsigned char *mapped[2];
+	size_t capacity;
+	bool persistent;
+	int nextBuffer;
+
+	std::shared_ptr<DecodedImage> image;
+	MyTexture texture;
+	GLenum format;
+	int nextRow;
+	std::chrono::steady_clock::time_point start;
+	UploadStats stats;
+};
+
+// true if the current context exposes the named extension
+bool HasGLExtension(const char *name);
+
+#endif
@@ -0,0 +1,297 @@
+// ==========================================================================
+// Filtering images larger than the GPU can hold, one tile at a time
+// ==========================================================================
+
+#include "tilerender.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "trace.h"
+
+using namespace std;
+
+// tiles are kept well below the texture limit, so that the half float
+// targets of a long chain stay small and tiles pipeline in useful steps
+const int MAX_TILE_SIZE = 2048;
+
+// smallest part of a tile worth keeping once its border is taken off
+const int MIN_TILE_CORE = 64;
+
+static int textureLimit = 0;
+
+int MaxTextureSize()
+{
+	GLint rectangle = 0;
+	GLint viewport[2] = { 0, 0 };
+	glGetIntegerv(GL_MAX_RECTANGLE_TEXTURE_SIZE, &rectangle);
+	glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewport);
+	int size = min(int(rectangle), int(min(viewport[0], viewport[1])));
+	return textureLimit > 0 ? min(size, textureLimit) : size;
+}
+
+void LimitTextureSize(int size)
+{
+	textureLimit = size;
+}
+
+TileRenderer::TileRenderer() : width(0), height(0), columns(0), nextTile(0), failed(false)
+{
+	for (Slot &slot : slots) {
+		slot.upload = 0;
+		slot.readback = 0;
+		slot.fence = 0;
+		slot.tile = -1;
+	}
+}
+
+bool TileRenderer::Initialize()
+{
+	if (!graph.Initialize()) return false;
+
+	// fragment.glsl without any effect defined draws the image unchanged
+	if (!InitializeShaders(&shader, "passvertex.glsl", "fragment.glsl")) return false;
+	for (Slot &slot : slots) {
+		glGenBuffers(1, &slot.upload);
+		glGenBuffers(1, &slot.readback);
+	}
+	return !CheckGLErrors();
+}
+
+void TileRenderer::Destroy()
+{
+	for (Slot &slot : slots) {
+		if (slot.fence) {
+			glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(slot.fence);
+		}
+		glDeleteBuffers(1, &slot.upload);
+		glDeleteBuffers(1, &slot.readback);
+		DestroyTexture(&slot.source);
+		DestroyFramebuffer(&slot.target);
+		slot.source = MyTexture();
+		slot.upload = slot.readback = 0;
+		slot.fence = 0;
+		slot.tile = -1;
+	}
+	image.reset();
+	graph.Destroy();
+	DestroyGeometry(&quad);
+	DestroyShaders(&shader);
+	shader = MyShader();
+}
+
+bool TileRenderer::Begin(const shared_ptr<DecodedImage> &source, const vector<FilterStage> &stages)
+{
+	if (!source || source->pixels == nullptr || shader.program == 0) return false;
+
+	stats = TileStats();
+	failed = false;
+	stats.border = ChainReach(stages);
+	int limit = min(MaxTextureSize(), MAX_TILE_SIZE);
+	stats.tileSize = limit - 2 * stats.border;
+	if (stats.tileSize < MIN_TILE_CORE) {
+		cout << "The filter chain reaches too far to split the image into tiles of at most "
+			<< limit << " texels" << endl;
+		return false;
+	}
+
+	graph.Clear();
+	for (const FilterStage &stage : stages)
+		graph.AddStage(stage);
+
+	image = source;
+	width = image->width;
+	height = image->height;
+	columns = (width + stats.tileSize - 1) / stats.tileSize;
+	stats.tiles = columns * ((height + stats.tileSize - 1) / stats.tileSize);
+	nextTile = 0;
+	pixels.resize(size_t(width) * height * 3);
+	start = chrono::steady_clock::now();
+	return true;
+}
+
+bool TileRenderer::Step(bool wait)
+{
+	TRACE_SCOPE("TileRenderer::Step");
+	if (!image) return false;
+	stats.frames++;
+
+	// a slot is reused once the tile it read back two tiles ago is collected
+	if (nextTile < stats.tiles) {
+		Slot &slot = slots[nextTile % 2];
+		if (slot.tile >= 0 && !Collect(&slot, wait)) return failed;
+		if (!Issue(&slot, nextTile++)) {
+			cout << "Unable to render tile " << nextTile << " of " << stats.tiles << endl;
+			Abandon();
+		}
+		return failed;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		Slot &slot = slots[(nextTile + i) % 2];
+		if (slot.tile >= 0 && !Collect(&slot, wait)) return failed;
+	}
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	image.reset();
+	CheckGLErrors();
+	return true;
+}
+
+// stops rendering the image after a tile failed, dropping the tiles still
+// being read back
+void TileRenderer::Abandon()
+{
+	for (Slot &slot : slots) {
+		if (slot.fence) {
+			glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(slot.fence);
+		}
+		slot.fence = 0;
+		slot.tile = -1;
+	}
+	image.reset();
+	failed = true;
+	CheckGLErrors();
+}
+
+// the part of a tile that is kept, without its border
+void TileRenderer::TileBounds(int tile, int *x0, int *y0, int *x1, int *y1) const
+{
+	*x0 = (tile % columns) * stats.tileSize;
+	*y0 = (tile / columns) * stats.tileSize;
+	*x1 = min(*x0 + stats.tileSize, width);
+	*y1 = min(*y0 + stats.tileSize, height);
+}
+
+bool TileRenderer::Issue(Slot *slot, int tile)
+{
+	int x0, y0, x1, y1;
+	TileBounds(tile, &x0, &y0, &x1, &y1);
+	int left = max(x0 - stats.border, 0);
+	int bottom = max(y0 - stats.border, 0);
+	int tileWidth = min(x1 + stats.border, width) - left;
+	int tileHeight = min(y1 + stats.border, height) - bottom;
+	int components = image->components;
+	GLenum format = TextureFormat(components);
+
+	// tiles at the right and top edges are smaller, so the source texture
+	// is reallocated when the size changes
+	MyTexture &source = slot->source;
+	if (source.textureID == 0 || source.width != tileWidth || source.height != tileHeight
+		|| source.format != format) {
+		DestroyTexture(&source);
+		source = MyTexture();
+		source.target = GL_TEXTURE_RECTANGLE;
+		source.format = format;
+		source.width = tileWidth;
+		source.height = tileHeight;
+		glGenTextures(1, &source.textureID);
+		glBindTexture(source.target, source.textureID);
+		glTexImage2D(source.target, 0, format, tileWidth, tileHeight, 0, format, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(source.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(source.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(source.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(source.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(source.target, 0);
+	}
+
+	// copy the tile's rows into the upload buffer, orphaning its previous
+	// contents so mapping never waits on the GPU
+	size_t rowBytes = size_t(tileWidth) * components;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->upload);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, rowBytes * tileHeight, nullptr, GL_STREAM_DRAW);
+	unsigned char *mapped = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+		rowBytes * tileHeight, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	if (!mapped) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	for (int row = 0; row < tileHeight; row++) {
+		memcpy(mapped + row * rowBytes,
+			image->pixels + (size_t(bottom + row) * width + left) * components, rowBytes);
+	}
+	if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(source.target, source.textureID);
+	glTexSubImage2D(source.target, 0, 0, 0, tileWidth, tileHeight, format, GL_UNSIGNED_BYTE, nullptr);
+	glBindTexture(source.target, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	// filter, then draw the result into an 8-bit target to read back
+	graph.Invalidate();
+	const MyTexture &output = graph.Run(source);
+	if (!InitializeFramebuffer(&slot->target, tileWidth, tileHeight, GL_RGBA8)
+		|| !InitializeQuad(&quad, 1.f, 1.f, float(tileWidth), float(tileHeight)))
+		return false;
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, tileWidth, tileHeight);
+	glBindFramebuffer(GL_FRAMEBUFFER, slot->target.framebuffer);
+	glUseProgram(shader.program);
+	glBindVertexArray(quad.vertexArray);
+	glBindTexture(output.target, output.textureID);
+	glDrawArrays(GL_TRIANGLES, 0, quad.elementCount);
+	glBindTexture(output.target, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->readback);
+	glBufferData(GL_PIXEL_PACK_BUFFER, size_t(tileWidth) * tileHeight * 3, nullptr, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, tileWidth, tileHeight, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot->tile = tile;
+	return slot->fence != 0;
+}
+
+// copies the kept part of a slot's tile into the image once it has arrived,
+// abandoning the image if the readback was lost; false if it has not arrived
+bool TileRenderer::Collect(Slot *slot, bool wait)
+{
+	auto waitStart = chrono::steady_clock::now();
+	GLenum status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+		wait ? GL_TIMEOUT_IGNORED : 0);
+	if (status == GL_TIMEOUT_EXPIRED) return false;
+	stats.waitSeconds += chrono::duration<double>(chrono::steady_clock::now() - waitStart).count();
+	glDeleteSync(slot->fence);
+	slot->fence = 0;
+
+	int x0, y0, x1, y1;
+	TileBounds(slot->tile, &x0, &y0, &x1, &y1);
+	int left = max(x0 - stats.border, 0);
+	int bottom = max(y0 - stats.border, 0);
+	int tileWidth = slot->target.texture.width;
+	int tileHeight = slot->target.texture.height;
+	slot->tile = -1;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->readback);
+	const unsigned char *mapped = static_cast<const unsigned char *>(glMapBufferRange(
+		GL_PIXEL_PACK_BUFFER, 0, size_t(tileWidth) * tileHeight * 3, GL_MAP_READ_BIT));
+	if (mapped) {
+		size_t bytes = size_t(x1 - x0) * 3;
+		for (int y = y0; y < y1; y++) {
+			memcpy(pixels.data() + (size_t(y) * width + x0) * 3,
+				mapped + (size_t(y - bottom) * tileWidth + (x0 - left)) * 3, bytes);
+		}
+	}
+	bool copied = mapped && glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (!copied) {
+		cout << "Unable to read back a tile of " << stats.tiles << endl;
+		Abandon();
+		return false;
+	}
+	return true;
+}
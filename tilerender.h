@@ -0,0 +1,102 @@
+// ==========================================================================
+// Filtering images larger than the GPU can hold, one tile at a time
+//
+// The image is cut into tiles that fit in a texture, each widened on every
+// side by the distance the filter chain reads, so the part of a tile that is
+// kept comes out exactly as it would on the whole image; the border is
+// clipped at the image edges, where the filters clamp as usual. Each tile is
+// uploaded through a pixel buffer, run through a filter graph, drawn into an
+// 8-bit target and read back into another pixel buffer. Two sets of buffers
+// alternate, so while one tile is read back the next is uploaded and
+// rendered, and the CPU only waits for the tile before last.
+// ==========================================================================
+#ifndef TILERENDER_H
+#define TILERENDER_H
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "boilerplate.h"
+#include "filtergraph.h"
+#include "imagecache.h"
+
+// largest texture edge the filters may use: the smaller of the rectangle
+// texture and viewport limits, or less if lowered with LimitTextureSize()
+int MaxTextureSize();
+void LimitTextureSize(int size);
+
+struct TileStats
+{
+	int tiles;
+	int tileSize;		// edge of the tiles kept, without the border
+	int border;			// texels each tile is widened by on every side
+	int frames;			// Step() calls the image took
+	double seconds;		// from Begin() until the last tile was collected
+	double waitSeconds;	// spent waiting for readbacks
+
+	TileStats() : tiles(0), tileSize(0), border(0), frames(0), seconds(0.0), waitSeconds(0.0)
+	{}
+};
+
+class TileRenderer
+{
+public:
+	TileRenderer();
+
+	// compiles the program drawing tiles; requires a current OpenGL context
+	bool Initialize();
+	void Destroy();
+
+	// starts filtering the image through the stages into 8-bit RGB rows in
+	// the image's bottom-up order
+	bool Begin(const std::shared_ptr<DecodedImage> &image, const std::vector<FilterStage> &stages);
+
+	// issues the next tile and collects the tile whose buffers it reuses,
+	// returning true once every tile is in Pixels() or a tile could not be
+	// rendered, which Failed() tells apart; without wait, it returns false
+	// rather than block on a readback that has not finished
+	bool Step(bool wait);
+
+	bool Active() const { return image != nullptr; }
+	// true if the last image stopped at a tile that could not be rendered or
+	// read back, leaving Pixels() incomplete
+	bool Failed() const { return failed; }
+	int Width() const { return width; }
+	int Height() const { return height; }
+	std::vector<unsigned char> &Pixels() { return pixels; }
+	const TileStats &Stats() const { return stats; }
+
+private:
+	struct Slot
+	{
+		GLuint upload;
+		GLuint readback;
+		MyTexture source;
+		MyFramebuffer target;
+		GLsync fence;
+		int tile;		// being read back, or -1
+	};
+
+	bool Issue(Slot *slot, int tile);
+	bool Collect(Slot *slot, bool wait);
+	void Abandon();
+	void TileBounds(int tile, int *x0, int *y0, int *x1, int *y1) const;
+
+	Slot slots[2];
+	FilterGraph graph;
+	MyShader shader;
+	MyGeometry quad;
+
+	std::shared_ptr<DecodedImage> image;
+	int width;
+	int height;
+	int columns;
+	int nextTile;
+	bool failed;
+	std::vector<unsigned char> pixels;
+	std::chrono::steady_clock::time_point start;
+	TileStats stats;
+};
+
+#endif
@@ -0,0 +1,175 @@
+// ==========================================================================
+// Trace events in the Chrome trace format
+// ==========================================================================
+
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Event
+{
+	const char *name;
+	int64_t start;		// nanoseconds since TraceStart()
+	int64_t duration;
+};
+
+// a thread's events fill chunks that are never moved, so the thread can keep
+// writing while TraceWrite() reads the events already published
+const size_t CHUNK_EVENTS = 4096;
+const size_t MAX_CHUNKS = 1024;		// about 100 MB of events per thread
+
+struct Chunk
+{
+	Event events[CHUNK_EVENTS];
+	atomic<size_t> count;
+	atomic<Chunk *> next;
+
+	Chunk() : count(0), next(nullptr)
+	{}
+};
+
+struct ThreadBuffer
+{
+	int id;
+	atomic<const char *> name;
+	Chunk head;
+	Chunk *tail;		// only used by the owning thread
+	size_t chunks;
+	atomic<size_t> dropped;
+
+	explicit ThreadBuffer(int id) : id(id), name(nullptr), tail(&head), chunks(1), dropped(0)
+	{}
+	~ThreadBuffer()
+	{
+		Chunk *chunk = head.next.load();
+		while (chunk) {
+			Chunk *next = chunk->next.load();
+			delete chunk;
+			chunk = next;
+		}
+	}
+};
+
+atomic<bool> recording(false);
+chrono::steady_clock::time_point origin;
+
+// every thread's buffer, kept after the thread exits so its events are
+// still written
+mutex registryMutex;
+vector<unique_ptr<ThreadBuffer>> registry;
+thread_local ThreadBuffer *localBuffer = nullptr;
+
+ThreadBuffer *LocalBuffer()
+{
+	if (!localBuffer) {
+		lock_guard<mutex> lock(registryMutex);
+		registry.emplace_back(new ThreadBuffer(int(registry.size()) + 1));
+		localBuffer = registry.back().get();
+	}
+	return localBuffer;
+}
+
+}
+
+void TraceStart()
+{
+	origin = chrono::steady_clock::now();
+	recording.store(true, memory_order_release);
+}
+
+bool TraceRecording()
+{
+	return recording.load(memory_order_acquire);
+}
+
+void TraceThreadName(const char *name)
+{
+	LocalBuffer()->name.store(name, memory_order_release);
+}
+
+void TraceEvent(const char *name, chrono::steady_clock::time_point start,
+	chrono::steady_clock::time_point end)
+{
+	ThreadBuffer *buffer = LocalBuffer();
+	Chunk *chunk = buffer->tail;
+	size_t count = chunk->count.load(memory_order_relaxed);
+	if (count == CHUNK_EVENTS) {
+		if (buffer->chunks == MAX_CHUNKS) {
+			buffer->dropped.fetch_add(1, memory_order_relaxed);
+			return;
+		}
+		Chunk *next = new Chunk();
+		chunk->next.store(next, memory_order_release);
+		buffer->tail = next;
+		buffer->chunks++;
+		chunk = next;
+		count = 0;
+	}
+	Event &event = chunk->events[count];
+	event.name = name;
+	event.start = chrono::duration_cast<chrono::nanoseconds>(start - origin).count();
+	event.duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+	chunk->count.store(count + 1, memory_order_release);
+}
+
+bool TraceWrite(const string &path)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file) {
+		cout << "Unable to write the trace to " << path << endl;
+		return false;
+	}
+
+	vector<ThreadBuffer *> buffers;
+	{
+		lock_guard<mutex> lock(registryMutex);
+		for (const unique_ptr<ThreadBuffer> &buffer : registry)
+			buffers.push_back(buffer.get());
+	}
+
+	// complete events with times in microseconds, then the thread names
+	size_t events = 0;
+	size_t dropped = 0;
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	for (ThreadBuffer *buffer : buffers) {
+		for (Chunk *chunk = &buffer->head; chunk; chunk = chunk->next.load(memory_order_acquire)) {
+			size_t count = chunk->count.load(memory_order_acquire);
+			for (size_t i = 0; i < count; i++) {
+				const Event &event = chunk->events[i];
+				fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+					"\"pid\": 1, \"tid\": %d}", events ? ",\n" : "", event.name, event.start * 1e-3,
+					event.duration * 1e-3, buffer->id);
+				events++;
+			}
+		}
+		dropped += buffer->dropped.load(memory_order_relaxed);
+	}
+	for (ThreadBuffer *buffer : buffers) {
+		const char *name = buffer->name.load(memory_order_acquire);
+		if (!name) continue;
+		fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+			"\"args\": {\"name\": \"%s\"}}", events ? ",\n" : "", buffer->id, name);
+		events++;
+	}
+	fprintf(file, "\n]}\n");
+	bool written = !ferror(file);
+	written = fclose(file) == 0 && written;
+
+	cout << "Wrote " << events << " trace events from " << buffers.size() << " threads to " << path;
+	if (dropped > 0) cout << " (" << dropped << " dropped when buffers filled)";
+	cout << endl;
+	return written;
+}
+
+#endif
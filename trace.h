@@ -0,0 +1,79 @@
+// ==========================================================================
+// Trace events in the Chrome trace format
+//
+// TRACE_SCOPE("name") records the time from where it appears to the end of
+// the enclosing block as one event on the calling thread. Events go into a
+// buffer owned by each thread, so recording one takes no lock: the thread
+// fills fixed-size chunks and publishes each event with an atomic count,
+// and only the first event on a thread takes a lock to register its buffer.
+// TraceWrite() saves everything recorded as JSON that chrome://tracing and
+// Perfetto open directly.
+//
+// Tracing is compiled in only when ENABLE_TRACE is defined ('make TRACE=1');
+// otherwise the macros expand to nothing and the functions do nothing. When
+// compiled in, events are only recorded after TraceStart(), and a scope
+// costs two reads of the clock and a store.
+// ==========================================================================
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+#ifdef ENABLE_TRACE
+
+#include <chrono>
+#include <cstdint>
+
+// starts recording; events before this call are dropped
+void TraceStart();
+bool TraceRecording();
+
+// writes every event recorded so far, returning false if the file could
+// not be written
+bool TraceWrite(const std::string &path);
+
+// names the calling thread in the trace; name must outlive the program,
+// e.g. a string literal
+void TraceThreadName(const char *name);
+
+// name must be a string literal, as only the pointer is kept
+void TraceEvent(const char *name, std::chrono::steady_clock::time_point start,
+	std::chrono::steady_clock::time_point end);
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char *name) : name(TraceRecording() ? name : nullptr)
+	{
+		if (this->name) start = std::chrono::steady_clock::now();
+	}
+	~TraceScope()
+	{
+		if (name) TraceEvent(name, start, std::chrono::steady_clock::now());
+	}
+
+private:
+	TraceScope(const TraceScope &);
+	TraceScope &operator=(const TraceScope &);
+
+	const char *name;
+	std::chrono::steady_clock::time_point start;
+};
+
+#define TRACE_JOIN_NAME(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_JOIN_NAME(traceScope, line)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_NAME(__LINE__)(name)
+#define TRACE_THREAD_NAME(name) TraceThreadName(name)
+
+#else
+
+inline void TraceStart() {}
+inline bool TraceRecording() { return false; }
+inline bool TraceWrite(const std::string &) { return false; }
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+#endif
@@ -16,10 +16,22 @@ layout(location = 2) in vec2 VertexTexture;
 out vec3 Colour;
 out vec2 textureCoords;
 
-uniform float theta = (M_PI/3.f);
-uniform float displaceX = 0.f;
-uniform float displaceY = 0.f;
-uniform float zoomVer = 1.f;
+// view and filter parameters shared by both shader stages, laid out to
+// match the ViewState structure in the main program
+layout(std140) uniform ViewState
+{
+	float theta;
+	float displaceX;
+	float displaceY;
+	float zoomVer;
+	int greyScale;
+	int filterType;
+	int blurType;
+	bool hue;
+	float redFilter;
+	float greenFilter;
+	float blueFilter;
+};
 
 void main()
 {
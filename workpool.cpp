@@ -0,0 +1,135 @@
+// ==========================================================================
+// Work-stealing thread pool for data-parallel CPU work
+// ==========================================================================
+
+#include "workpool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "trace.h"
+
+using namespace std;
+
+WorkPool::WorkPool(unsigned threads)
+	: job(nullptr), remaining(0), generation(0), stopping(false), runSeconds(0.0)
+{
+	if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+	for (unsigned i = 0; i < threads; i++)
+		queues.push_back(unique_ptr<Queue>(new Queue()));
+	for (unsigned i = 0; i < threads; i++)
+		workers.push_back(thread(&WorkPool::WorkerLoop, this, i));
+}
+
+WorkPool::~WorkPool()
+{
+	{
+		lock_guard<mutex> lock(wakeMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (thread &worker : workers)
+		worker.join();
+}
+
+void WorkPool::Run(size_t count, const function<void(size_t, unsigned)> &task)
+{
+	lock_guard<mutex> running(runMutex);
+	if (count == 0) return;
+	auto start = chrono::steady_clock::now();
+
+	// the job is set before any task is queued, and workers only read it
+	// after taking a task under the queue's lock
+	job = &task;
+	remaining = count;
+	size_t n = queues.size();
+	for (size_t w = 0; w < n; w++) {
+		lock_guard<mutex> lock(queues[w]->lock);
+		for (size_t i = count * w / n; i < count * (w + 1) / n; i++)
+			queues[w]->tasks.push_back(i);
+	}
+	{
+		lock_guard<mutex> lock(wakeMutex);
+		generation++;
+	}
+	wake.notify_all();
+
+	{
+		unique_lock<mutex> lock(wakeMutex);
+		finished.wait(lock, [this] { return remaining == 0; });
+	}
+	job = nullptr;
+	runSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+vector<WorkerStats> WorkPool::Stats() const
+{
+	vector<WorkerStats> stats;
+	for (const unique_ptr<Queue> &queue : queues)
+		stats.push_back(queue->stats);
+	return stats;
+}
+
+void WorkPool::ResetStats()
+{
+	lock_guard<mutex> running(runMutex);
+	for (unique_ptr<Queue> &queue : queues)
+		queue->stats = WorkerStats();
+	runSeconds = 0.0;
+}
+
+bool WorkPool::Take(unsigned worker, size_t *index)
+{
+	{
+		Queue &own = *queues[worker];
+		lock_guard<mutex> lock(own.lock);
+		if (!own.tasks.empty()) {
+			*index = own.tasks.front();
+			own.tasks.pop_front();
+			return true;
+		}
+	}
+
+	// steal the task furthest from where the victim is working
+	size_t n = queues.size();
+	for (size_t i = 1; i < n; i++) {
+		Queue &victim = *queues[(worker + i) % n];
+		lock_guard<mutex> lock(victim.lock);
+		if (!victim.tasks.empty()) {
+			*index = victim.tasks.back();
+			victim.tasks.pop_back();
+			queues[worker]->stats.steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkPool::WorkerLoop(unsigned worker)
+{
+	TRACE_THREAD_NAME("work pool");
+	unsigned seen = 0;
+	WorkerStats &stats = queues[worker]->stats;
+	for (;;) {
+		{
+			unique_lock<mutex> lock(wakeMutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+		}
+
+		size_t index;
+		while (Take(worker, &index)) {
+			auto start = chrono::steady_clock::now();
+			(*job)(index, worker);
+			stats.busySeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			stats.tasks++;
+
+			// the last task to finish wakes Run()
+			if (remaining.fetch_sub(1) == 1) {
+				lock_guard<mutex> lock(wakeMutex);
+				finished.notify_all();
+			}
+		}
+	}
+}
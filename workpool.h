@@ -0,0 +1,79 @@
+// ==========================================================================
+// Work-stealing thread pool for data-parallel CPU work
+//
+// Run() splits a range of task indices into contiguous blocks, one per
+// worker, so neighbouring tiles of an image stay on the same core. A worker
+// takes its own tasks from the front of its queue and, once that is empty,
+// steals from the back of another worker's queue, so uneven tiles still keep
+// every thread busy. The time each worker spends in tasks is recorded, which
+// together with the wall time of the runs gives its utilization.
+// ==========================================================================
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkerStats
+{
+	size_t tasks;
+	size_t steals;			// tasks taken from another worker's queue
+	double busySeconds;		// time spent running tasks
+
+	WorkerStats() : tasks(0), steals(0), busySeconds(0.0)
+	{}
+};
+
+class WorkPool
+{
+public:
+	// zero threads picks the number of hardware threads
+	explicit WorkPool(unsigned threads = 0);
+	~WorkPool();
+
+	unsigned Threads() const { return unsigned(workers.size()); }
+
+	// calls task(index, worker) for every index below count on the pool's
+	// threads and returns once all have finished; worker is below Threads()
+	// and identifies the calling thread, e.g. to select scratch memory
+	void Run(size_t count, const std::function<void(size_t, unsigned)> &task);
+
+	// per worker totals, and the wall time spent inside Run(), since
+	// construction or the last ResetStats()
+	std::vector<WorkerStats> Stats() const;
+	double RunSeconds() const { return runSeconds; }
+	void ResetStats();
+
+private:
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<size_t> tasks;
+		WorkerStats stats;
+	};
+
+	void WorkerLoop(unsigned worker);
+	bool Take(unsigned worker, size_t *index);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<Queue>> queues;
+	const std::function<void(size_t, unsigned)> *job;
+	std::atomic<size_t> remaining;
+
+	std::mutex runMutex;			// held by Run() for the whole run
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	unsigned generation;
+	bool stopping;
+	double runSeconds;
+};
+
+#endif